@@ -0,0 +1,274 @@
+// Inline assembly injection
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#include "client/hook/Assembly.hpp"
+#include "client/hook/ExecutableArena.hpp"
+
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+namespace hook
+{
+namespace hook_asm
+{
+
+#if defined(ARCH_CPU_X86_64) && !defined(OS_WIN)
+// Leaf functions may keep data below rsp, the thunk has to stay clear of it
+static const int32_t kRedZone = 128;
+#else
+static const int32_t kRedZone = 0;
+#endif
+
+static const int32_t kWordSize = static_cast<int32_t>(sizeof(uintptr_t));
+static const int32_t kXmmSize = static_cast<int32_t>(sizeof(RegPack::Xmm) * RegPack::kXmmCount);
+static const int32_t kRegistersSize = kWordSize * RegPack::kRegisterCount;
+
+// Registers the call to the callback may change, plus ebx/rbx that keeps the RegPack address across it
+#if defined(ARCH_CPU_X86_64) && defined(OS_WIN)
+static const uint32_t kClobbered = RegPack::Saves(RegPack::kEax) | RegPack::Saves(RegPack::kEcx) |
+    RegPack::Saves(RegPack::kEdx) | RegPack::Saves(RegPack::kEbx) | RegPack::Saves(RegPack::kR8) |
+    RegPack::Saves(RegPack::kR9) | RegPack::Saves(RegPack::kR10) | RegPack::Saves(RegPack::kR11);
+#elif defined(ARCH_CPU_X86_64)
+static const uint32_t kClobbered = RegPack::Saves(RegPack::kEax) | RegPack::Saves(RegPack::kEcx) |
+    RegPack::Saves(RegPack::kEdx) | RegPack::Saves(RegPack::kEbx) | RegPack::Saves(RegPack::kEsi) |
+    RegPack::Saves(RegPack::kEdi) | RegPack::Saves(RegPack::kR8) | RegPack::Saves(RegPack::kR9) |
+    RegPack::Saves(RegPack::kR10) | RegPack::Saves(RegPack::kR11);
+#else
+static const uint32_t kClobbered = RegPack::Saves(RegPack::kEax) | RegPack::Saves(RegPack::kEcx) |
+    RegPack::Saves(RegPack::kEdx) | RegPack::Saves(RegPack::kEbx);
+#endif
+
+// Hardware encoding of a RegPack register, the first eight are in pushad order
+static uint8_t GetRegisterCode(size_t reg)
+{
+    return static_cast<uint8_t>(reg < 8 ? 7 - reg : reg);
+}
+
+// Builds the thunk code for where it will end up, at |base|
+class ThunkWriter
+{
+public:
+    explicit ThunkWriter(uintptr_t base) : m_base(base) {}
+
+    uintptr_t Here() const { return m_base + m_code.size(); }
+
+    void Bytes(std::initializer_list<uint8_t> bytes) { m_code.insert(m_code.end(), bytes); }
+
+    template <typename T>
+    void Value(T value)
+    {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+        m_code.insert(m_code.end(), bytes, bytes + sizeof(T));
+    }
+
+    // Emits the ModRM, SIB and displacement of [esp/rsp + disp] with |reg| in ModRM.reg
+    void StackOperand(uint8_t reg, int32_t disp)
+    {
+        if (disp >= -128 && disp <= 127)
+        {
+            Bytes({static_cast<uint8_t>(0x44 | ((reg & 7) << 3)), 0x24, static_cast<uint8_t>(disp)});
+        }
+        else
+        {
+            Bytes({static_cast<uint8_t>(0x84 | ((reg & 7) << 3)), 0x24});
+            Value(disp);
+        }
+    }
+
+    // lea esp/rsp, [esp/rsp + disp], unlike add/sub it leaves the flags alone
+    void AdjustStack(int32_t disp)
+    {
+        if (disp == 0)
+        {
+            return;
+        }
+
+#if defined(ARCH_CPU_X86_64)
+        Bytes({0x48});
+#endif
+        Bytes({0x8D});
+        StackOperand(4, disp);
+    }
+
+    // mov [esp/rsp + disp], reg / mov reg, [esp/rsp + disp]
+    void MoveRegister(bool store, uint8_t reg, int32_t disp)
+    {
+#if defined(ARCH_CPU_X86_64)
+        Bytes({static_cast<uint8_t>(reg >= 8 ? 0x4C : 0x48)});
+#endif
+        Bytes({static_cast<uint8_t>(store ? 0x89 : 0x8B)});
+        StackOperand(reg, disp);
+    }
+
+    // movups [esp/rsp + disp], xmm / movups xmm, [esp/rsp + disp]
+    void MoveXmm(bool store, uint8_t xmm, int32_t disp)
+    {
+        if (xmm >= 8)
+        {
+            Bytes({0x44});
+        }
+
+        Bytes({0x0F, static_cast<uint8_t>(store ? 0x11 : 0x10)});
+        StackOperand(xmm, disp);
+    }
+
+    // call/jmp rel32 when it reaches, through eax/rax or [rip] otherwise
+    void Branch(uint8_t opcode, uintptr_t dest)
+    {
+        if (IsRel32Reachable(Here() + 5, dest))
+        {
+            Bytes({opcode});
+            Value(static_cast<int32_t>(dest - (Here() + 4)));
+        }
+        else if (opcode == 0xE8)
+        {
+            // mov rax, dest; call rax
+            Bytes({0x48, 0xB8});
+            Value(dest);
+            Bytes({0xFF, 0xD0});
+        }
+        else
+        {
+            // jmp qword ptr [rip + 0]
+            Bytes({0xFF, 0x25, 0x00, 0x00, 0x00, 0x00});
+            Value(dest);
+        }
+    }
+
+    std::vector<uint8_t>& Code() { return m_code; }
+
+private:
+    uintptr_t m_base;
+    std::vector<uint8_t> m_code;
+};
+
+static void WriteThunk(ThunkWriter& writer, void (*callback)(RegPack*), uintptr_t returnTo, uint32_t saveMask)
+{
+    // Construct the RegPack structure on the stack, from the top down
+    writer.AdjustStack(-kRedZone - kRegistersSize);
+
+    for (size_t reg = 0; reg < RegPack::kRegisterCount; reg++)
+    {
+        if ((saveMask & RegPack::Saves(static_cast<RegPack::RegName>(reg))) && reg != RegPack::kEsp)
+        {
+            writer.MoveRegister(true, GetRegisterCode(reg), static_cast<int32_t>(reg) * kWordSize);
+        }
+    }
+
+    // Let RegPack::esp be what it was before the thunk: lea eax, [esp + ...]; mov [esp + 12], eax
+    if (saveMask & RegPack::Saves(RegPack::kEsp))
+    {
+#if defined(ARCH_CPU_X86_64)
+        writer.Bytes({0x48});
+#endif
+        writer.Bytes({0x8D});
+        writer.StackOperand(0, kRegistersSize + kRedZone);
+        writer.MoveRegister(true, 0, RegPack::kEsp * kWordSize);
+    }
+
+    if (saveMask & RegPack::kSaveFlags)
+    {
+        // pushfd/pushfq
+        writer.Bytes({0x9C});
+        writer.AdjustStack(-kXmmSize);
+    }
+    else
+    {
+        writer.AdjustStack(-kXmmSize - kWordSize);
+    }
+
+    if (saveMask & RegPack::kSaveXmm)
+    {
+        for (uint8_t xmm = 0; xmm < RegPack::kXmmCount; xmm++)
+        {
+            writer.MoveXmm(true, xmm, static_cast<int32_t>(xmm * sizeof(RegPack::Xmm)));
+        }
+    }
+
+    // The stack pointer now points at the RegPack. Keep it in ebx/rbx (already saved), align the stack for the call
+    // and clear the direction flag, both are expected by the callee but not guaranteed in the middle of a function.
+#if defined(ARCH_CPU_X86_64)
+    // mov rbx, rsp; and rsp, -16; cld
+    writer.Bytes({0x48, 0x89, 0xE3, 0x48, 0x83, 0xE4, 0xF0, 0xFC});
+#if defined(OS_WIN)
+    // mov rcx, rbx; sub rsp, 32 (shadow space)
+    writer.Bytes({0x48, 0x89, 0xD9, 0x48, 0x83, 0xEC, 0x20});
+#else
+    // mov rdi, rbx
+    writer.Bytes({0x48, 0x89, 0xDF});
+#endif
+    writer.Branch(0xE8, reinterpret_cast<uintptr_t>(callback));
+    // mov rsp, rbx
+    writer.Bytes({0x48, 0x89, 0xDC});
+#else
+    // mov ebx, esp; and esp, -16; sub esp, 12; push ebx; cld
+    writer.Bytes({0x89, 0xE3, 0x83, 0xE4, 0xF0, 0x83, 0xEC, 0x0C, 0x53, 0xFC});
+    writer.Branch(0xE8, reinterpret_cast<uintptr_t>(callback));
+    // mov esp, ebx
+    writer.Bytes({0x89, 0xDC});
+#endif
+
+    // Destructs the RegPack from the stack, nothing from here on may change the flags
+    if (saveMask & RegPack::kSaveXmm)
+    {
+        for (uint8_t xmm = 0; xmm < RegPack::kXmmCount; xmm++)
+        {
+            writer.MoveXmm(false, xmm, static_cast<int32_t>(xmm * sizeof(RegPack::Xmm)));
+        }
+    }
+
+    if (saveMask & RegPack::kSaveFlags)
+    {
+        // popfd/popfq
+        writer.AdjustStack(kXmmSize);
+        writer.Bytes({0x9D});
+    }
+    else
+    {
+        writer.AdjustStack(kXmmSize + kWordSize);
+    }
+
+    for (size_t reg = 0; reg < RegPack::kRegisterCount; reg++)
+    {
+        if ((saveMask & RegPack::Saves(static_cast<RegPack::RegName>(reg))) && reg != RegPack::kEsp)
+        {
+            writer.MoveRegister(false, GetRegisterCode(reg), static_cast<int32_t>(reg) * kWordSize);
+        }
+    }
+
+    writer.AdjustStack(kRegistersSize + kRedZone);
+
+    writer.Branch(0xE9, returnTo);
+}
+
+uint8_t* MakeRegPackThunk(void (*callback)(RegPack*), uintptr_t returnTo, uint32_t saveMask)
+{
+    saveMask |= kClobbered;
+
+    // The sizing pass may pick shorter branches than the real one, leave room for the long forms
+    ThunkWriter sizing(0);
+    WriteThunk(sizing, callback, returnTo, saveMask);
+
+    const size_t size = sizing.Code().size() + 32;
+    uint8_t* thunk = ExecutableArena::Get().Allocate(size, returnTo);
+
+    if (!thunk)
+    {
+        return nullptr;
+    }
+
+    ThunkWriter writer(reinterpret_cast<uintptr_t>(thunk));
+    WriteThunk(writer, callback, returnTo, saveMask);
+
+    memcpy(thunk, writer.Code().data(), writer.Code().size());
+    return thunk;
+}
+
+}  // namespace hook_asm
+}  // namespace hook
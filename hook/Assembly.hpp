@@ -12,7 +12,9 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "build/BuildConfig.hpp"
 #include "client/hook/Hook.hpp"
+#include "client/hook/LazyPointer.hpp"
 
 namespace hook
 {
@@ -22,6 +24,7 @@ class RegPack
 public:
     // The ordering is very important, don't change
     // The first field is the last to be pushed and first to be poped
+    // On x64 these name the 64 bit registers (kEax is rax and so on)
     enum RegName
     {
         kEdi,
@@ -31,7 +34,18 @@ public:
         kEbx,
         kEdx,
         kEcx,
-        kEax
+        kEax,
+#if defined(ARCH_CPU_X86_64)
+        kR8,
+        kR9,
+        kR10,
+        kR11,
+        kR12,
+        kR13,
+        kR14,
+        kR15,
+#endif
+        kRegisterCount
     };
 
     enum EfFlag
@@ -45,6 +59,31 @@ public:
         kOverflowFlag = 11
     };
 
+    // Which parts of the RegPack a thunk fills in and writes back, see MakeInlineMasked. Registers are selected with
+    // Saves(kEax) and so on.
+    enum SaveMask : uint32_t
+    {
+        kSaveFlags = 1u << 30,
+        kSaveXmm = 1u << 31,
+        kSaveAll = 0xFFFFFFFFu
+    };
+
+    static constexpr uint32_t Saves(RegName reg) { return 1u << reg; }
+
+#if defined(ARCH_CPU_X86_64)
+    static const size_t kXmmCount = 16;
+#else
+    static const size_t kXmmCount = 8;
+#endif
+
+    union Xmm
+    {
+        float f32[4];
+        double f64[2];
+        uint32_t u32[4];
+        uint64_t u64[2];
+    };
+
     uintptr_t edi() { return m_registers[kEdi]; }
 
     uintptr_t esi() { return m_registers[kEsi]; }
@@ -61,9 +100,47 @@ public:
 
     uintptr_t eax() { return m_registers[kEax]; }
 
+#if defined(ARCH_CPU_X86_64)
+    uintptr_t rdi() { return m_registers[kEdi]; }
+
+    uintptr_t rsi() { return m_registers[kEsi]; }
+
+    uintptr_t rbp() { return m_registers[kEbp]; }
+
+    uintptr_t rsp() { return m_registers[kEsp]; }
+
+    uintptr_t rbx() { return m_registers[kEbx]; }
+
+    uintptr_t rdx() { return m_registers[kEdx]; }
+
+    uintptr_t rcx() { return m_registers[kEcx]; }
+
+    uintptr_t rax() { return m_registers[kEax]; }
+
+    uintptr_t r8() { return m_registers[kR8]; }
+
+    uintptr_t r9() { return m_registers[kR9]; }
+
+    uintptr_t r10() { return m_registers[kR10]; }
+
+    uintptr_t r11() { return m_registers[kR11]; }
+
+    uintptr_t r12() { return m_registers[kR12]; }
+
+    uintptr_t r13() { return m_registers[kR13]; }
+
+    uintptr_t r14() { return m_registers[kR14]; }
+
+    uintptr_t r15() { return m_registers[kR15]; }
+#endif
+
     uintptr_t& operator[](size_t i) { return m_registers[i]; }
     const uintptr_t& operator[](size_t i) const { return m_registers[i]; }
 
+    // Changes are written back to the register, like the general purpose ones (but unlike esp)
+    Xmm& xmm(size_t i) { return m_xmm[i]; }
+    const Xmm& xmm(size_t i) const { return m_xmm[i]; }
+
     template <uint32_t bit>  // bit starts from 0, use EfFlag enum
     bool Flag()
     {
@@ -73,11 +150,14 @@ public:
     bool jnb() { return Flag<kCarryFlag>() == false; }
 
 private:
+    // MOVUPS, below everything else
+    Xmm m_xmm[kXmmCount];
+
     // PUSHFD / POPFD
-    uint32_t m_eflags;
+    uintptr_t m_eflags;
 
-    // PUSHAD/POPAD -- must be the lastest fields (because of esp)
-    uintptr_t m_registers[8];
+    // PUSHAD/POPAD (and r8-r15 pushed before them on x64) -- must be the lastest fields (because of esp)
+    uintptr_t m_registers[kRegisterCount];
 };
 
 // Lowest level stuff (actual assembly) goes on the following namespace
@@ -95,64 +175,54 @@ struct Wrapper
     }
 };
 
-// Constructs a RegPack and calls the wrapper functor
-template <typename W>  // where W is of type wrapper
-inline void __declspec(naked) MakeRegPackAndCall()
+// Generates a thunk near |returnTo| that constructs a RegPack on the stack, calls |callback| with it, writes the
+// registers back and jumps to |returnTo|. The thunk is entered with a jump, not a call, so it works in the middle of
+// a function (on x64 System V it also steps over the red zone). Only the parts of the RegPack in |saveMask| are
+// saved and restored, plus the registers the call itself clobbers. Returns nullptr if no memory was left in range.
+uint8_t* MakeRegPackThunk(void (*callback)(RegPack*), uintptr_t returnTo, uint32_t saveMask = RegPack::kSaveAll);
+
+}  // namespace hook_asm
+
+// Makes inline assembly (but not assembly, an actual functor of type FuncT) at address, continuing at |end|. Returns
+// false, leaving the code untouched, if the thunk or the jump to it couldn't be made.
+template <typename FuncT, uint32_t saveMask = RegPack::kSaveAll>
+bool MakeInlineTo(MemoryPointer at, MemoryPointer end)
 {
-    __asm
+    uint8_t* thunk = hook_asm::MakeRegPackThunk(&hook_asm::Wrapper<FuncT>::Call, end.AsInt(), saveMask);
+
+    if (!thunk)
     {
-        // Construct the RegPack structure on the stack
-        // Pushes general purposes registers to RegPack
-        pushad
-            // Add 4 to RegPack::esp because of our return pointer, let it be as before this func is called
-        add[esp + 12], 4
-        // Pushes EFLAGS to RegPack
-        pushfd
-
-            // Call wrapper sending RegPack as parameter
-        push esp
-        Call W::Call
-        add esp, 4
-
-        // Destructs the RegPack from the stack
-        // Fix RegPack::esp before popping it (doesn't make a difference though) (+4 because eflags)
-        sub[esp + 12 + 4], 4
-
-        // Warning: Do not use any instruction that changes EFLAGS after this (-> sub affects EF!! <-)
-        popfd
-
-        popad
-
-        // Back to normal flow
-        ret
+        return false;
     }
-}
 
-}  // namespace hook_asm
+    return MakeBranch(at, 0xE9, thunk);
+}
 
 // Makes inline assembly (but not assembly, an actual functor of type FuncT) at address
 template <typename FuncT>
-void MakeInline(MemoryPointer at)
+bool MakeInline(MemoryPointer at)
 {
-    using functor = hook_asm::Wrapper<FuncT>;
-    if (false)
-        functor::Call(nullptr);  // To instantiate the template, if not done __asm will fail
-    MakeCall(at, hook_asm::MakeRegPackAndCall<functor>);
+    return MakeInlineTo<FuncT>(at, at + 5);
 }
 
-// Same as above, but it NOPs everything between at and end (exclusive), then performs MakeInline
+// Same as above, but it also NOPs everything between the jump and end (exclusive), once the jump is in place
 template <typename FuncT>
-void MakeInline(MemoryPointer at, MemoryPointer end)
+bool MakeInline(MemoryPointer at, MemoryPointer end)
 {
-    MakeRangedNop(at, end);
-    MakeInline<FuncT>(at);
+    if (!MakeInlineTo<FuncT>(at, end))
+    {
+        return false;
+    }
+
+    MakeRangedNop(at + 5, end);
+    return true;
 }
 
 // Same as above, but (at,end) are template parameters.
 // On this case the functor can be passed as argument since there will be one func instance for each at,end not just for
 // each FuncT
 template <uintptr_t at, uintptr_t end, typename FuncT>
-void MakeInline(FuncT func)
+bool MakeInline(FuncT func)
 {
     // Stores the func object
     // TODO: Use smart pointers
@@ -172,11 +242,36 @@ void MakeInline(FuncT func)
 }
 
 //  MakeInline
-//  Same as above, but (end) is calculated by the length of a call instruction
+//  Same as above, but (end) is calculated by the length of a jump instruction
 template <uintptr_t at, typename FuncT>
-void MakeInline(FuncT func)
+bool MakeInline(FuncT func)
 {
     return MakeInline<at, at + 5, FuncT>(func);
 }
 
+// Same as MakeInline, but only the registers in |saveMask| are saved into the RegPack and written back, for hooks
+// in hot code. The functor must not touch anything else in the RegPack. The registers the call clobbers anyway are
+// always preserved, the flags and the xmm registers only if kSaveFlags and kSaveXmm are set: leave them out only if
+// the code after the hook doesn't read flags or keep values in xmm registers from before it.
+//
+// Usage:
+//   MakeInlineMasked<RegPack::Saves(RegPack::kEax) | RegPack::Saves(RegPack::kEcx), CountHits>(0x4C6F20);
+template <uint32_t saveMask, typename FuncT>
+bool MakeInlineMasked(MemoryPointer at)
+{
+    return MakeInlineTo<FuncT, saveMask>(at, at + 5);
+}
+
+template <uint32_t saveMask, typename FuncT>
+bool MakeInlineMasked(MemoryPointer at, MemoryPointer end)
+{
+    if (!MakeInlineTo<FuncT, saveMask>(at, end))
+    {
+        return false;
+    }
+
+    MakeRangedNop(at + 5, end);
+    return true;
+}
+
 }  // namespace hook
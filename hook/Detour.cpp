@@ -0,0 +1,267 @@
+// Inline function detours
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#include "client/hook/Detour.hpp"
+#include "client/hook/ExecutableArena.hpp"
+#include "client/hook/InstructionDecoder.hpp"
+
+#include "build/BuildConfig.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace hook
+{
+
+// Size of the jmp rel32 written over the prologue
+static const size_t kJumpSize = 5;
+
+// Copied instructions grow to at most 16 bytes each, followed by the jump back
+static const size_t kBlockSize = 128;
+
+// Writes code into the trampoline, knowing where it'll end up
+class CodeWriter
+{
+public:
+    CodeWriter(uint8_t* buffer, size_t size) : m_buffer(buffer), m_size(size), m_pos(0) {}
+
+    uintptr_t Here() const { return reinterpret_cast<uintptr_t>(m_buffer + m_pos); }
+
+    bool Bytes(const void* data, size_t size)
+    {
+        if (m_pos + size > m_size)
+        {
+            return false;
+        }
+
+        memcpy(m_buffer + m_pos, data, size);
+        m_pos += size;
+        return true;
+    }
+
+    template <typename T>
+    bool Value(T value)
+    {
+        return Bytes(&value, sizeof(T));
+    }
+
+    // jmp/call rel32 when it reaches, jmp/call [rip] otherwise
+    bool Branch(uint8_t opcode, uintptr_t dest)
+    {
+        if (IsRel32Reachable(Here() + 5, dest))
+        {
+            return Value<uint8_t>(opcode) && Value(static_cast<int32_t>(dest - (Here() + 4)));
+        }
+
+        if (opcode == 0xE9)
+        {
+            // jmp qword ptr [rip + 0]
+            return Value<uint16_t>(0x25FF) && Value<uint32_t>(0) && Value<uint64_t>(dest);
+        }
+
+        // call qword ptr [rip + 2]; jmp +8
+        return Value<uint16_t>(0x15FF) && Value<uint32_t>(2) && Value<uint16_t>(0x08EB) && Value<uint64_t>(dest);
+    }
+
+    bool ConditionalBranch(uint8_t condition, uintptr_t dest)
+    {
+        if (IsRel32Reachable(Here() + 6, dest))
+        {
+            return Value<uint8_t>(0x0F) && Value<uint8_t>(0x80 | condition) &&
+                Value(static_cast<int32_t>(dest - (Here() + 4)));
+        }
+
+        // Inverted jcc over an absolute jmp
+        return Value<uint8_t>(0x70 | (condition ^ 1)) && Value<uint8_t>(14) && Branch(0xE9, dest);
+    }
+
+private:
+    uint8_t* m_buffer;
+    size_t m_size;
+    size_t m_pos;
+};
+
+Detour::Detour(MemoryPointer target, MemoryPointer detour) :
+    m_target(target),
+    m_detour(detour),
+    m_trampoline(nullptr),
+    m_patchSize(0),
+    m_installed(false)
+{
+    // The jump covers several instructions of the prologue, a thread preempted after the first one would resume inside
+    // it. Other threads are parked outside of the patched bytes while they're written (Windows and Linux only, see
+    // LiveWrite).
+    m_patch.Live(true, true);
+}
+
+Detour::~Detour()
+{
+    if (Remove() && m_trampoline)
+    {
+        ExecutableArena::Get().Free(m_trampoline, kBlockSize);
+    }
+}
+
+bool Detour::Install()
+{
+    if (m_installed)
+    {
+        return true;
+    }
+
+    if (!m_trampoline && !BuildTrampoline())
+    {
+        return false;
+    }
+
+    const uintptr_t target = m_target.AsInt();
+
+    // Goes through a jump thunk if the detour is out of rel32 range
+    m_patch.MakeJmp(target, m_detour);
+
+    if (m_patchSize > kJumpSize)
+    {
+        m_patch.MakeNop(target + kJumpSize, m_patchSize - kJumpSize);
+    }
+
+    m_installed = m_patch.Commit();
+
+    // Don't leave the patches queued for the next attempt
+    if (!m_installed)
+    {
+        m_patch.Discard();
+    }
+
+    return m_installed;
+}
+
+bool Detour::Remove()
+{
+    if (!m_installed)
+    {
+        return true;
+    }
+
+    m_installed = !m_patch.Rollback();
+    return !m_installed;
+}
+
+bool Detour::BuildTrampoline()
+{
+    const uintptr_t target = m_target.AsInt();
+    const uint8_t* code = m_target.Get<uint8_t>();
+
+    // Within rel32 range of the function, for the jumps to and from it and RIP-relative operands
+    uint8_t* trampoline = ExecutableArena::Get().Allocate(kBlockSize, target);
+
+    if (!trampoline)
+    {
+        return false;
+    }
+
+    CodeWriter writer(trampoline, kBlockSize);
+
+    size_t offset = 0;
+    bool ended = false;
+
+    // Branches into the bytes being overwritten can't be redirected
+    uintptr_t lowestInternalTarget = UINTPTR_MAX;
+
+    while (offset < kJumpSize)
+    {
+        const uint8_t* instruction = code + offset;
+        const uintptr_t address = target + offset;
+
+        Instruction decoded;
+
+        if (!DecodeInstruction(instruction, decoded))
+        {
+            break;
+        }
+
+        bool written;
+
+        if (decoded.relativeBranch)
+        {
+            const uintptr_t dest = decoded.BranchTarget(instruction, address);
+            const uint8_t opcode = decoded.opcode;
+
+            if (dest > target)
+            {
+                lowestInternalTarget = std::min(lowestInternalTarget, dest);
+            }
+
+            if (decoded.opcodeMap == Instruction::kMap0F || (opcode >= 0x70 && opcode <= 0x7F))
+            {
+                written = writer.ConditionalBranch(opcode & 0x0F, dest);
+            }
+            else if (opcode == 0xE8 || opcode == 0xE9 || opcode == 0xEB)
+            {
+                written = writer.Branch(opcode == 0xE8 ? 0xE8 : 0xE9, dest);
+            }
+            else
+            {
+                // loop/jecxz only come in rel8
+                written = false;
+            }
+        }
+        else if (decoded.ripRelative)
+        {
+            const uintptr_t dest = decoded.RipTarget(instruction, address);
+            const uintptr_t newEnd = writer.Here() + decoded.length;
+
+            written = IsRel32Reachable(newEnd, dest) && writer.Bytes(instruction, decoded.length);
+
+            if (written)
+            {
+                const int32_t displacement = static_cast<int32_t>(dest - newEnd);
+                memcpy(reinterpret_cast<uint8_t*>(newEnd - decoded.length + decoded.dispOffset), &displacement,
+                    sizeof(displacement));
+            }
+        }
+        else
+        {
+            written = writer.Bytes(instruction, decoded.length);
+        }
+
+        if (!written)
+        {
+            break;
+        }
+
+        offset += decoded.length;
+
+        if (decoded.terminator)
+        {
+            ended = true;
+            break;
+        }
+    }
+
+    // A function that ends early can still be patched if it's followed by padding
+    while (ended && offset < kJumpSize && (code[offset] == 0xCC || code[offset] == 0x90))
+    {
+        offset++;
+    }
+
+    const bool relocated = offset >= kJumpSize && lowestInternalTarget >= target + offset &&
+        (ended || writer.Branch(0xE9, target + offset));
+
+    if (!relocated)
+    {
+        ExecutableArena::Get().Free(trampoline, kBlockSize);
+        return false;
+    }
+
+    m_trampoline = trampoline;
+    m_patchSize = offset;
+
+    return true;
+}
+
+}  // namespace hook
@@ -0,0 +1,86 @@
+// Inline function detours
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "client/hook/MemoryPointer.hpp"
+#include "client/hook/PatchTransaction.hpp"
+
+namespace hook
+{
+
+// Redirects a function to |detour| by overwriting its prologue with a jump. The overwritten instructions are moved
+// into a trampoline (with relative branches and RIP-relative operands fixed up) that then jumps back into the
+// function, so the original stays callable through GetOriginal. Install and Remove park the other threads on Windows
+// and Linux, elsewhere they must not run the function while it's patched.
+//
+// Usage:
+//   static Detour s_detour(0x401000, MyFunction);
+//   s_detour.Install();
+//   s_detour.GetOriginal<int (*)(int)>()(42);
+class Detour
+{
+public:
+    Detour(MemoryPointer target, MemoryPointer detour);
+
+    // Removes the detour, the trampoline is only freed if that worked
+    ~Detour();
+
+    Detour(const Detour&) = delete;
+    Detour& operator=(const Detour&) = delete;
+
+    // Fails if the prologue can't be relocated (too short, or holding a loop/jecxz or a branch back into itself)
+    bool Install();
+
+    bool Remove();
+
+    bool IsInstalled() const { return m_installed; }
+
+    // Calls into the relocated prologue, only valid after a successful Install
+    template <typename T>
+    T GetOriginal() const
+    {
+        return reinterpret_cast<T>(m_trampoline);
+    }
+
+    // Number of prologue bytes overwritten by the jump
+    size_t GetPatchSize() const { return m_patchSize; }
+
+private:
+    bool BuildTrampoline();
+
+    MemoryPointer m_target;
+    MemoryPointer m_detour;
+
+    uint8_t* m_trampoline;
+    size_t m_patchSize;
+
+    PatchTransaction m_patch;
+    bool m_installed;
+};
+
+// Detours |at| to |detour|, returning the original function or nullptr if the prologue can't be relocated. The
+// detour stays in place for the lifetime of the process.
+template <typename T>
+inline T MakeDetour(MemoryPointer at, T detour)
+{
+    auto instance = new Detour(at, reinterpret_cast<void*>(detour));
+
+    if (!instance->Install())
+    {
+        delete instance;
+        return nullptr;
+    }
+
+    return instance->GetOriginal<T>();
+}
+
+}  // namespace hook
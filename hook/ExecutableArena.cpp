@@ -0,0 +1,322 @@
+// Near executable memory allocator
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#include "client/hook/ExecutableArena.hpp"
+
+#include "build/BuildConfig.hpp"
+
+#if defined(OS_WIN)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include <cstring>
+
+namespace hook
+{
+
+// Also the allocation granularity on Windows
+static const uintptr_t kRegionSize = 0x10000;
+
+// Regions stay this close to the address they're requested near, so anything inside them is in rel32 range of
+// anything within the same distance on the other side
+static const uintptr_t kNearDistance = 0x40000000;
+
+static bool IsNear(uintptr_t nearAddress, uintptr_t begin, uintptr_t end)
+{
+#if !defined(ARCH_CPU_X86_64)
+    // The whole address space is in rel32 range
+    nearAddress = 0;
+#endif
+
+    if (nearAddress == 0)
+    {
+        return true;
+    }
+
+    const uintptr_t low = begin < nearAddress ? nearAddress - begin : 0;
+    const uintptr_t high = end > nearAddress ? end - nearAddress : 0;
+
+    return low <= kNearDistance && high <= kNearDistance;
+}
+
+static size_t GetSizeClass(size_t size)
+{
+    size_t sizeClass = 0;
+
+    while ((ExecutableArena::kMinBlockSize << sizeClass) < size)
+    {
+        sizeClass++;
+    }
+
+    return sizeClass;
+}
+
+static void* MapRegion(uintptr_t address)
+{
+#if defined(OS_WIN)
+    return VirtualAlloc(reinterpret_cast<void*>(address), kRegionSize, MEM_RESERVE | MEM_COMMIT,
+        PAGE_EXECUTE_READWRITE);
+#else
+    void* memory = mmap(reinterpret_cast<void*>(address), kRegionSize, PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return memory != MAP_FAILED ? memory : nullptr;
+#endif
+}
+
+static void UnmapRegion(void* memory)
+{
+#if defined(OS_WIN)
+    VirtualFree(memory, 0, MEM_RELEASE);
+#else
+    munmap(memory, kRegionSize);
+#endif
+}
+
+// Tries free address space at increasing distances from |nearAddress|, alternating above and below
+static void* MapRegionNear(uintptr_t nearAddress)
+{
+    if (nearAddress == 0)
+    {
+        return MapRegion(0);
+    }
+
+    const uintptr_t origin = nearAddress & ~(kRegionSize - 1);
+
+#if defined(OS_WIN)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    const uintptr_t lowest = reinterpret_cast<uintptr_t>(info.lpMinimumApplicationAddress);
+    const uintptr_t highest = reinterpret_cast<uintptr_t>(info.lpMaximumApplicationAddress);
+
+    // Walk the free blocks of the address space instead of probing every 64 KB
+    uintptr_t up = origin;
+    uintptr_t down = origin;
+
+    while (up != 0 || down != 0)
+    {
+        for (uintptr_t* cursor : {&up, &down})
+        {
+            if (*cursor == 0)
+            {
+                continue;
+            }
+
+            MEMORY_BASIC_INFORMATION memoryInfo;
+
+            if (!IsNear(nearAddress, *cursor, *cursor + kRegionSize) || *cursor < lowest || *cursor > highest ||
+                !VirtualQuery(reinterpret_cast<void*>(*cursor), &memoryInfo, sizeof(memoryInfo)))
+            {
+                *cursor = 0;
+                continue;
+            }
+
+            const uintptr_t blockBegin = reinterpret_cast<uintptr_t>(memoryInfo.BaseAddress);
+            const uintptr_t blockEnd = blockBegin + memoryInfo.RegionSize;
+
+            if (memoryInfo.State == MEM_FREE)
+            {
+                // Closest aligned spot inside the free block
+                const uintptr_t address = cursor == &up ? (blockBegin + kRegionSize - 1) & ~(kRegionSize - 1) :
+                                                          (blockEnd - kRegionSize) & ~(kRegionSize - 1);
+
+                if (address >= blockBegin && address + kRegionSize <= blockEnd &&
+                    IsNear(nearAddress, address, address + kRegionSize))
+                {
+                    if (void* memory = MapRegion(address))
+                    {
+                        return memory;
+                    }
+                }
+            }
+
+            if (cursor == &up)
+            {
+                up = (blockEnd + kRegionSize - 1) & ~(kRegionSize - 1);
+            }
+            else
+            {
+                down = blockBegin >= kRegionSize ? (blockBegin - kRegionSize) & ~(kRegionSize - 1) : 0;
+            }
+        }
+    }
+#else
+    // The kernel takes the hint if that spot is free, and picks something else otherwise
+    for (uintptr_t distance = kRegionSize; distance < kNearDistance; distance += kRegionSize * 16)
+    {
+        for (uintptr_t hint : {origin + distance, origin - distance})
+        {
+            void* memory = MapRegion(hint);
+
+            if (!memory)
+            {
+                continue;
+            }
+
+            const uintptr_t address = reinterpret_cast<uintptr_t>(memory);
+
+            if (IsNear(nearAddress, address, address + kRegionSize))
+            {
+                return memory;
+            }
+
+            UnmapRegion(memory);
+        }
+    }
+#endif
+
+    return nullptr;
+}
+
+ExecutableArena& ExecutableArena::Get()
+{
+    static ExecutableArena arena;
+    return arena;
+}
+
+uint8_t* ExecutableArena::Allocate(size_t size, uintptr_t nearAddress)
+{
+    if (size == 0 || size > kMaxBlockSize)
+    {
+        return nullptr;
+    }
+
+    const size_t sizeClass = GetSizeClass(size);
+    const size_t blockSize = kMinBlockSize << sizeClass;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (Region& region : m_regions)
+    {
+        if (!IsNear(nearAddress, region.begin, region.end))
+        {
+            continue;
+        }
+
+        std::vector<uint8_t*>& freeBlocks = region.freeBlocks[sizeClass];
+
+        if (!freeBlocks.empty())
+        {
+            uint8_t* block = freeBlocks.back();
+            freeBlocks.pop_back();
+            return block;
+        }
+
+        // Blocks are naturally aligned to their size
+        const uintptr_t next = (region.next + blockSize - 1) & ~(blockSize - 1);
+
+        if (next + blockSize <= region.end)
+        {
+            region.next = next + blockSize;
+            return reinterpret_cast<uint8_t*>(next);
+        }
+    }
+
+    Region* region = AddRegion(nearAddress);
+
+    if (!region)
+    {
+        return nullptr;
+    }
+
+    region->next = region->begin + blockSize;
+    return reinterpret_cast<uint8_t*>(region->begin);
+}
+
+void ExecutableArena::Free(void* memory, size_t size)
+{
+    if (!memory || size == 0 || size > kMaxBlockSize)
+    {
+        return;
+    }
+
+    const uintptr_t address = reinterpret_cast<uintptr_t>(memory);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (Region& region : m_regions)
+    {
+        if (address >= region.begin && address < region.end)
+        {
+            // Leave a trap behind, in case something still jumps here
+            memset(memory, 0xCC, size);
+            region.freeBlocks[GetSizeClass(size)].push_back(static_cast<uint8_t*>(memory));
+            return;
+        }
+    }
+}
+
+uint8_t* ExecutableArena::GetJumpThunk(uintptr_t nearAddress, uintptr_t dest)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (auto it = m_thunks.lower_bound(dest); it != m_thunks.end() && it->first == dest; ++it)
+        {
+            const uintptr_t thunk = reinterpret_cast<uintptr_t>(it->second);
+
+            if (IsNear(nearAddress, thunk, thunk + kMinBlockSize))
+            {
+                return it->second;
+            }
+        }
+    }
+
+    uint8_t* thunk = Allocate(kMinBlockSize, nearAddress);
+
+    if (!thunk)
+    {
+        return nullptr;
+    }
+
+#if defined(ARCH_CPU_X86_64)
+    // jmp qword ptr [rip + 0]
+    const uint8_t code[] = {0xFF, 0x25, 0x00, 0x00, 0x00, 0x00};
+
+    memcpy(thunk, code, sizeof(code));
+    memcpy(thunk + sizeof(code), &dest, sizeof(dest));
+#else
+    const uint32_t offset = static_cast<uint32_t>(dest - (reinterpret_cast<uintptr_t>(thunk) + 5));
+
+    thunk[0] = 0xE9;
+    memcpy(thunk + 1, &offset, sizeof(offset));
+#endif
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_thunks.emplace(dest, thunk);
+
+    return thunk;
+}
+
+ExecutableArena::Region* ExecutableArena::AddRegion(uintptr_t nearAddress)
+{
+    void* memory = MapRegionNear(nearAddress);
+
+    if (!memory)
+    {
+        return nullptr;
+    }
+
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(memory);
+
+    // Fill with int3, stray jumps into unused memory trap instead of sliding into a neighbouring block
+    memset(memory, 0xCC, kRegionSize);
+
+    m_regions.emplace_back();
+
+    Region& region = m_regions.back();
+    region.begin = begin;
+    region.end = begin + kRegionSize;
+    region.next = begin;
+
+    return &region;
+}
+
+}  // namespace hook
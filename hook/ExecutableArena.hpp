@@ -0,0 +1,78 @@
+// Near executable memory allocator
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace hook
+{
+
+// Whether a rel32 operand ending at |from| can reach |to|. Always true on 32 bit targets.
+inline bool IsRel32Reachable(uintptr_t from, uintptr_t to)
+{
+    const intptr_t distance = static_cast<intptr_t>(to - from);
+    return distance == static_cast<int32_t>(distance);
+}
+
+// Hands out small blocks of executable memory for trampolines and thunks. Memory is reserved in regions within rel32
+// range of the address it's requested near, every region is mapped read/write/execute once and then carved into
+// blocks, so allocations don't change page protection.
+class ExecutableArena
+{
+public:
+    // Blocks are a power of two between these
+    static const size_t kMinBlockSize = 16;
+    static const size_t kMaxBlockSize = 1024;
+
+    static ExecutableArena& Get();
+
+    // Returns |size| bytes, 16 byte aligned, reachable with a rel32 from anywhere within 1 GB of |nearAddress|. A
+    // |nearAddress| of 0 means anywhere. Returns nullptr if nothing's free in range.
+    uint8_t* Allocate(size_t size, uintptr_t nearAddress = 0);
+
+    // |size| has to be the one passed to Allocate
+    void Free(void* memory, size_t size);
+
+    // Returns a thunk jumping to |dest| that a rel32 at |nearAddress| can reach, shared between callers
+    uint8_t* GetJumpThunk(uintptr_t nearAddress, uintptr_t dest);
+
+    ExecutableArena(const ExecutableArena&) = delete;
+    ExecutableArena& operator=(const ExecutableArena&) = delete;
+
+private:
+    static const size_t kSizeClasses = 7;
+
+    struct Region
+    {
+        uintptr_t begin;
+        uintptr_t end;
+        uintptr_t next;  // Untouched memory starts here
+
+        std::vector<uint8_t*> freeBlocks[kSizeClasses];
+    };
+
+    ExecutableArena() = default;
+
+    // Reserves a new region, within range of |nearAddress| if it isn't 0
+    Region* AddRegion(uintptr_t nearAddress);
+
+    std::vector<Region> m_regions;
+
+    // Destination -> thunks
+    std::multimap<uintptr_t, uint8_t*> m_thunks;
+
+    std::mutex m_mutex;
+};
+
+}  // namespace hook
@@ -0,0 +1,220 @@
+// Executable image metadata
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#include "client/hook/ExecutableMeta.hpp"
+
+#if defined(OS_WIN)
+#include <windows.h>
+#else
+#include <elf.h>
+#include <link.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+namespace hook
+{
+
+void ExecutableMeta::AddRange(uintptr_t begin, uintptr_t end)
+{
+    if (m_rangeCount < kMaxRanges && begin < end)
+    {
+        m_ranges[m_rangeCount++] = {begin, end};
+    }
+}
+
+void ExecutableMeta::AddDataRange(uintptr_t begin, uintptr_t end)
+{
+    if (m_dataRangeCount < kMaxRanges && begin < end)
+    {
+        m_dataRanges[m_dataRangeCount++] = {begin, end};
+    }
+}
+
+#if defined(OS_WIN)
+
+ExecutableMeta::ExecutableMeta(void* module) :
+    m_base((uintptr_t)module),
+    m_identity(0),
+    m_rangeCount(0)
+{
+    PIMAGE_DOS_HEADER dosHeader = GetRVA<IMAGE_DOS_HEADER>(0);
+    PIMAGE_NT_HEADERS ntHeader = GetRVA<IMAGE_NT_HEADERS>(dosHeader->e_lfanew);
+
+    AddRange(m_base, m_base + ntHeader->OptionalHeader.SizeOfCode);
+
+    PIMAGE_SECTION_HEADER section = IMAGE_FIRST_SECTION(ntHeader);
+
+    for (WORD i = 0; i < ntHeader->FileHeader.NumberOfSections; i++, section++)
+    {
+        const DWORD access =
+            section->Characteristics & (IMAGE_SCN_MEM_READ | IMAGE_SCN_MEM_WRITE | IMAGE_SCN_MEM_EXECUTE);
+
+        if (access == IMAGE_SCN_MEM_READ && (section->Characteristics & IMAGE_SCN_CNT_INITIALIZED_DATA))
+        {
+            const uintptr_t begin = m_base + section->VirtualAddress;
+            AddDataRange(begin, begin + section->Misc.VirtualSize);
+        }
+    }
+    m_identity = (static_cast<uint64_t>(ntHeader->FileHeader.TimeDateStamp) << 32) |
+        ntHeader->OptionalHeader.SizeOfImage;
+}
+
+uintptr_t ExecutableMeta::GetMainModule()
+{
+    return reinterpret_cast<uintptr_t>(GetModuleHandle(nullptr));
+}
+
+#else
+
+namespace
+{
+
+// Program headers of a loaded object, they live in the mapped image so they stay valid after the lookup
+struct ElfObject
+{
+    uintptr_t address;
+    uintptr_t bias;
+    const ElfW(Phdr)* phdr;
+    size_t phnum;
+};
+
+int FindElfObject(dl_phdr_info* info, size_t, void* data)
+{
+    auto object = static_cast<ElfObject*>(data);
+
+    for (size_t i = 0; i < info->dlpi_phnum; i++)
+    {
+        const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+        const uintptr_t begin = info->dlpi_addr + phdr.p_vaddr;
+
+        // The main executable always comes first
+        if (object->address == 0 ||
+            (phdr.p_type == PT_LOAD && object->address >= begin && object->address < begin + phdr.p_memsz))
+        {
+            object->bias = info->dlpi_addr;
+            object->phdr = info->dlpi_phdr;
+            object->phnum = info->dlpi_phnum;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Lowest PT_LOAD address, where the ELF header gets mapped
+uintptr_t GetElfBase(const ElfObject& object)
+{
+    uintptr_t lowest = UINTPTR_MAX;
+
+    for (size_t i = 0; i < object.phnum; i++)
+    {
+        if (object.phdr[i].p_type == PT_LOAD)
+        {
+            lowest = std::min<uintptr_t>(lowest, object.phdr[i].p_vaddr);
+        }
+    }
+
+    const uintptr_t pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    return object.bias + ((lowest == UINTPTR_MAX ? 0 : lowest) & ~(pageSize - 1));
+}
+
+// Objects that weren't loaded by the dynamic linker (i.e. mapped by hand) are parsed from their headers instead
+bool ParseElfHeaders(uintptr_t address, ElfObject& object)
+{
+    auto header = reinterpret_cast<const ElfW(Ehdr)*>(address);
+
+    if (memcmp(header->e_ident, ELFMAG, SELFMAG) != 0)
+    {
+        return false;
+    }
+
+    object.phdr = reinterpret_cast<const ElfW(Phdr)*>(address + header->e_phoff);
+    object.phnum = header->e_phnum;
+    object.bias = 0;
+    object.bias = address - GetElfBase(object);
+    return true;
+}
+
+}  // namespace
+
+ExecutableMeta::ExecutableMeta(void* module) :
+    m_base((uintptr_t)module),
+    m_identity(0),
+    m_rangeCount(0)
+{
+    InitializeElf(m_base);
+}
+
+bool ExecutableMeta::InitializeElf(uintptr_t address)
+{
+    ElfObject object = {address, 0, nullptr, 0};
+
+    if (!dl_iterate_phdr(&FindElfObject, &object) && !ParseElfHeaders(address, object))
+    {
+        return false;
+    }
+
+    m_base = GetElfBase(object);
+    m_loadBias = object.bias;
+
+    for (size_t i = 0; i < object.phnum; i++)
+    {
+        const ElfW(Phdr)& phdr = object.phdr[i];
+        const uintptr_t begin = object.bias + phdr.p_vaddr;
+
+        if (phdr.p_type == PT_LOAD && (phdr.p_flags & PF_X))
+        {
+            AddRange(begin, begin + phdr.p_memsz);
+        }
+        else if (phdr.p_type == PT_LOAD && !(phdr.p_flags & PF_W))
+        {
+            AddDataRange(begin, begin + phdr.p_memsz);
+        }
+        else if (phdr.p_type == PT_DYNAMIC)
+        {
+            m_dynamic = begin;
+        }
+        else if (phdr.p_type == PT_NOTE && m_identity == 0)
+        {
+            // Look for NT_GNU_BUILD_ID, the first 8 bytes of the id are as good as a hash
+            for (uintptr_t note = begin, end = begin + phdr.p_memsz; note + sizeof(ElfW(Nhdr)) <= end;)
+            {
+                auto nhdr = reinterpret_cast<const ElfW(Nhdr)*>(note);
+                const uintptr_t name = note + sizeof(ElfW(Nhdr));
+                const uintptr_t desc = name + ((nhdr->n_namesz + 3) & ~3);
+
+                if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 &&
+                    memcmp(reinterpret_cast<const void*>(name), "GNU", 4) == 0)
+                {
+                    memcpy(&m_identity, reinterpret_cast<const void*>(desc),
+                        std::min<size_t>(sizeof(m_identity), nhdr->n_descsz));
+                    break;
+                }
+
+                note = desc + ((nhdr->n_descsz + 3) & ~3);
+            }
+        }
+    }
+
+    return true;
+}
+
+uintptr_t ExecutableMeta::GetMainModule()
+{
+    ElfObject object = {0, 0, nullptr, 0};
+    dl_iterate_phdr(&FindElfObject, &object);
+
+    return GetElfBase(object);
+}
+
+#endif
+
+}  // namespace hook
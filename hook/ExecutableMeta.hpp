@@ -0,0 +1,138 @@
+// Executable image metadata
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "build/BuildConfig.hpp"
+
+namespace hook
+{
+
+// Describes the code ranges of a loaded module (PE code section or ELF executable PT_LOAD segments), or an arbitrary
+// range given by the caller
+class ExecutableMeta
+{
+public:
+    struct Range
+    {
+        uintptr_t begin;
+        uintptr_t end;
+    };
+
+    // ELF images rarely have more than one or two executable segments
+    static const size_t kMaxRanges = 8;
+
+    template <typename TReturn, typename TOffset>
+    TReturn* GetRVA(TOffset rva)
+    {
+        return (TReturn*)(m_base + rva);
+    }
+
+    // |module| is the image base. On ELF platforms any address inside the module will do.
+    explicit ExecutableMeta(void* module);
+
+    ExecutableMeta(uintptr_t begin, uintptr_t end) :
+        m_base(begin),
+        m_identity(0),
+        m_rangeCount(1)
+    {
+        m_ranges[0] = {begin, end};
+    }
+
+    // Start of the first code range
+    inline uintptr_t begin() const
+    {
+        return m_rangeCount != 0 ? m_ranges[0].begin : m_base;
+    }
+
+    // End of the last code range
+    inline uintptr_t end() const
+    {
+        return m_rangeCount != 0 ? m_ranges[m_rangeCount - 1].end : m_base;
+    }
+
+    // Code ranges in address order, scanners should only look inside these
+    inline const Range* ranges() const
+    {
+        return m_ranges;
+    }
+
+    inline size_t rangeCount() const
+    {
+        return m_rangeCount;
+    }
+
+    // Read-only data ranges (PE sections that are neither writable nor executable, ELF PT_LOAD segments without
+    // PF_W and PF_X) in address order, none for a range given by the caller
+    inline const Range* dataRanges() const
+    {
+        return m_dataRanges;
+    }
+
+    inline size_t dataRangeCount() const
+    {
+        return m_dataRangeCount;
+    }
+
+    // Address RVAs are relative to
+    inline uintptr_t base() const
+    {
+        return m_base;
+    }
+
+    // Identifies the module build (PE TimeDateStamp and SizeOfImage, or ELF build-id), 0 if unknown
+    inline uint64_t identity() const
+    {
+        return m_identity;
+    }
+
+#if !defined(OS_WIN)
+    // Address of the dynamic section (PT_DYNAMIC), 0 if there's none
+    inline uintptr_t dynamic() const
+    {
+        return m_dynamic;
+    }
+
+    // Difference between the addresses the image was linked at and where it's loaded, file offsets and virtual
+    // addresses in the dynamic section are relative to it
+    inline uintptr_t loadBias() const
+    {
+        return m_loadBias;
+    }
+#endif
+
+    // Returns the image base of the process main executable
+    static uintptr_t GetMainModule();
+
+private:
+    void AddRange(uintptr_t begin, uintptr_t end);
+    void AddDataRange(uintptr_t begin, uintptr_t end);
+
+#if !defined(OS_WIN)
+    bool InitializeElf(uintptr_t address);
+#endif
+
+    uintptr_t m_base;
+    uint64_t m_identity;
+
+    Range m_ranges[kMaxRanges];
+    size_t m_rangeCount;
+
+    Range m_dataRanges[kMaxRanges];
+    size_t m_dataRangeCount = 0;
+
+#if !defined(OS_WIN)
+    uintptr_t m_dynamic = 0;
+    uintptr_t m_loadBias = 0;
+#endif
+};
+
+}  // namespace hook
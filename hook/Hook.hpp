@@ -10,49 +10,112 @@
 
 #include <stddef.h>
 #include <stdint.h>
+
+#include "build/BuildConfig.hpp"
+
+#if defined(OS_WIN)
 #include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
+#include <cstring>
+#include <mutex>
 #include <type_traits>
+#include <vector>
 
+#include "client/hook/ExecutableArena.hpp"
 #include "client/hook/MemoryPointer.hpp"
+#include "client/hook/PatchTransaction.hpp"
 
 namespace hook
 {
 
 // Memory protection
 
-inline bool ProtectMemory(MemoryPointer addr, size_t size, DWORD protection)
+#if defined(OS_WIN)
+using ProtectFlags = DWORD;
+
+inline bool ProtectMemory(MemoryPointer addr, size_t size, ProtectFlags protection)
 {
     return !!VirtualProtect(addr.Get(), size, protection, &protection);
 }
 
-inline bool UnprotectMemory(MemoryPointer addr, size_t size, DWORD& out_oldprotect)
+inline bool UnprotectMemory(MemoryPointer addr, size_t size, ProtectFlags& out_oldprotect)
 {
     return !!VirtualProtect(addr.Get(), size, PAGE_EXECUTE_READWRITE, &out_oldprotect);
 }
+#else
+// PROT_* flags
+using ProtectFlags = int;
+
+// mprotect works on whole pages
+inline std::vector<uintptr_t> GetPages(MemoryPointer addr, size_t size)
+{
+    static const uintptr_t pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    std::vector<uintptr_t> pages;
+
+    for (uintptr_t page = addr.AsInt() & ~(pageSize - 1); page < addr.AsInt() + size; page += pageSize)
+    {
+        pages.push_back(page);
+    }
+
+    return pages;
+}
+
+inline bool ProtectMemory(MemoryPointer addr, size_t size, ProtectFlags protection)
+{
+    return SetPageProtection(GetPages(addr, size), protection);
+}
+
+// Like VirtualProtect, a range over pages that differ reports the protection of the first one. ScopedUnprotect gives
+// each page its own back instead.
+inline bool UnprotectMemory(MemoryPointer addr, size_t size, ProtectFlags& out_oldprotect)
+{
+    return SetPageProtection(GetPages(addr, size), PROT_READ | PROT_WRITE | PROT_EXEC, &out_oldprotect);
+}
+#endif
 
 class ScopedUnprotect
 {
 public:
-    ScopedUnprotect(MemoryPointer addr, size_t size)
+    // Holds the patch mutex until destroyed, so hook functions running in parallel can patch the same page
+    ScopedUnprotect(MemoryPointer addr, size_t size) : m_lock(GetPatchMutex())
     {
         if (size == 0)
             m_unprotected = false;
+#if defined(OS_WIN)
         else
             m_unprotected = UnprotectMemory(m_addr = addr.Get<void>(), m_size = size, m_oldProtect);
+#else
+        else
+            m_unprotected = UnprotectPages(m_pages = GetPages(addr, size));
+#endif
     }
 
     ~ScopedUnprotect()
     {
+#if defined(OS_WIN)
         if (m_unprotected)
             ProtectMemory(m_addr.Get(), m_size, m_oldProtect);
+#else
+        if (m_unprotected)
+            RestorePages(m_pages);
+#endif
     }
 
 private:
+#if defined(OS_WIN)
     MemoryPointer m_addr;
     size_t m_size;
-    DWORD m_oldProtect;
+    ProtectFlags m_oldProtect;
+#else
+    // Each one gets its own protection back, which PatchTransaction remembers
+    std::vector<uintptr_t> m_pages;
+#endif
     bool m_unprotected;
+    std::unique_lock<std::recursive_mutex> m_lock;
 };
 
 // Methods for reading/writing memory
@@ -186,19 +249,41 @@ inline MemoryPointer ReadRelativeOffset(MemoryPointer at, size_t sizeofAddr = 4)
     }
 }
 
-inline void MakeRelativeOffset(MemoryPointer at, MemoryPointer dest, size_t sizeofAddr = 4)
+// Returns what a rel32 at |at| has to point at to reach |dest|: |dest| itself, or on x64 a jump thunk near |at| when
+// it's out of range. nullptr if no thunk memory is free in range.
+inline MemoryPointer GetRel32Destination(MemoryPointer at, MemoryPointer dest)
+{
+    if (IsRel32Reachable(at.AsInt() + 4, dest.AsInt()))
+    {
+        return dest;
+    }
+
+    return ExecutableArena::Get().GetJumpThunk(at.AsInt(), dest.AsInt());
+}
+
+// Returns false, leaving |at| untouched, if a rel32 can't reach |dest| even through a jump thunk
+inline bool MakeRelativeOffset(MemoryPointer at, MemoryPointer dest, size_t sizeofAddr = 4)
 {
     switch (sizeofAddr)
     {
         case 1:
             Write<int8_t>(at, static_cast<int8_t>(GetRelativeOffset(dest, at + sizeofAddr)));
-            break;
+            return true;
         case 2:
             Write<int16_t>(at, static_cast<int16_t>(GetRelativeOffset(dest, at + sizeofAddr)));
-            break;
+            return true;
         case 4:
+            dest = GetRel32Destination(at, dest);
+
+            if (!dest.AsInt())
+            {
+                return false;
+            }
+
             Write<int32_t>(at, static_cast<int32_t>(GetRelativeOffset(dest, at + sizeofAddr)));
-            break;
+            return true;
+        default:
+            return false;
     }
 }
 
@@ -218,7 +303,12 @@ inline MemoryPointer GetBranchDestination(MemoryPointer at)
             {
                 case 0x15:  // call dword ptr [addr]
                 case 0x25:  // jmp dword ptr [addr]
+#if defined(ARCH_CPU_X86_64)
+                    // [rip + disp32]
+                    return *ReadRelativeOffset(at + 2, 4).Get<void*>();
+#else
                     return *(Read<uint32_t*>(at + 2));
+#endif
             }
             break;
         }
@@ -226,31 +316,51 @@ inline MemoryPointer GetBranchDestination(MemoryPointer at)
     return nullptr;
 }
 
-// Jump Near
+// Writes a 5 byte E8/E9 |opcode| with its rel32 in one go. Returns false without touching |at| if |dest| is out of
+// range and no jump thunk fits near |at|.
+inline bool MakeBranch(MemoryPointer at, uint8_t opcode, MemoryPointer dest)
+{
+    const MemoryPointer target = GetRel32Destination(at + 1, dest);
+
+    if (!target.AsInt())
+    {
+        return false;
+    }
+
+    uint8_t code[5] = {opcode};
+    const uint32_t offset = GetRelativeOffset(target, at + sizeof(code));
+    memcpy(code + 1, &offset, sizeof(offset));
+
+    MemCpy(at, code, sizeof(code));
+    return true;
+}
+
+// Jump Near. Returns the old branch destination, nullptr if there was none or |dest| couldn't be reached, in which
+// case |at| is left as it was. Use MakeBranch where the two need to be told apart.
 inline MemoryPointer MakeJmp(MemoryPointer at, MemoryPointer dest = nullptr)
 {
     auto p = GetBranchDestination(at);
-    Write<uint8_t>(at, 0xE9);
 
-    if (!!dest.AsInt())
+    if (!dest.AsInt())
     {
-        MakeRelativeOffset(at + 1, dest, 4);
+        Write<uint8_t>(at, 0xE9);
+        return p;
     }
 
-    return p;
+    return MakeBranch(at, 0xE9, dest) ? p : nullptr;
 }
 
 inline MemoryPointer MakeCall(MemoryPointer at, MemoryPointer dest = nullptr)
 {
     auto p = GetBranchDestination(at);
-    Write<uint8_t>(at, 0xE8);
 
-    if (!!dest.AsInt())
+    if (!dest.AsInt())
     {
-        MakeRelativeOffset(at + 1, dest, 4);
+        Write<uint8_t>(at, 0xE8);
+        return p;
     }
 
-    return p;
+    return MakeBranch(at, 0xE8, dest) ? p : nullptr;
 }
 
 inline MemoryPointer MakeShortJmp(MemoryPointer at, MemoryPointer dest = nullptr)
@@ -0,0 +1,244 @@
+// Multi-listener function hooks
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "build/BuildConfig.hpp"
+#include "client/hook/Detour.hpp"
+#include "client/hook/LazyPointer.hpp"
+
+namespace hook
+{
+
+// Listener list and dispatch logic shared by every calling convention
+template <typename Ret, typename... Args>
+class HookChainBase
+{
+public:
+    class Next;
+
+    // A listener gets the rest of the chain as |next|. Calling it runs the remaining listeners and then the original
+    // function, not calling it skips them.
+    using Listener = std::function<Ret(Next& next, Args... args)>;
+
+    class Next
+    {
+    public:
+        Ret operator()(Args... args)
+        {
+            if (m_index < m_list->listeners.size())
+            {
+                Next next(m_list, m_index + 1, m_original);
+                return m_list->listeners[m_index].function(next, args...);
+            }
+
+            return m_original(args...);
+        }
+
+    private:
+        friend class HookChainBase;
+
+        using Original = Ret (*)(Args...);
+
+        Next(const typename HookChainBase::List* list, size_t index, Original original) :
+            m_list(list), m_index(index), m_original(original)
+        {
+        }
+
+        const typename HookChainBase::List* m_list;
+        size_t m_index;
+        Original m_original;
+    };
+
+    // Listeners with a lower priority run first. Returns an id for Remove.
+    uint32_t Add(Listener listener, int32_t priority = 0)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto list = std::make_unique<List>(*m_list.load(std::memory_order_relaxed));
+        auto entry = std::upper_bound(list->listeners.begin(), list->listeners.end(), priority,
+            [](int32_t value, const Entry& other) { return value < other.priority; });
+
+        const uint32_t id = ++m_lastId;
+        list->listeners.insert(entry, Entry{id, priority, std::move(listener)});
+
+        Publish(std::move(list));
+        return id;
+    }
+
+    bool Remove(uint32_t id)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto list = std::make_unique<List>(*m_list.load(std::memory_order_relaxed));
+        auto entry = std::find_if(list->listeners.begin(), list->listeners.end(),
+            [id](const Entry& other) { return other.id == id; });
+
+        if (entry == list->listeners.end())
+        {
+            return false;
+        }
+
+        list->listeners.erase(entry);
+
+        Publish(std::move(list));
+        return true;
+    }
+
+    size_t Size() const { return m_list.load(std::memory_order_acquire)->listeners.size(); }
+
+protected:
+    struct Entry
+    {
+        uint32_t id;
+        int32_t priority;
+        Listener function;
+    };
+
+    // Never modified once published
+    struct List
+    {
+        std::vector<Entry> listeners;
+    };
+
+    HookChainBase() : m_lastId(0)
+    {
+        m_retired.emplace_back(std::make_unique<List>());
+        m_list.store(m_retired.back().get(), std::memory_order_release);
+    }
+
+    // Called from the hooked function, takes no locks
+    Ret Dispatch(typename Next::Original original, Args... args) const
+    {
+        Next next(m_list.load(std::memory_order_acquire), 0, original);
+        return next(args...);
+    }
+
+private:
+    // A list that was swapped out may still be walked by a thread in Dispatch. There's no cheap way to know when
+    // the last one left, and listeners change rarely, so old lists are only freed with the chain.
+    void Publish(std::unique_ptr<List> list)
+    {
+        m_list.store(list.get(), std::memory_order_release);
+        m_retired.emplace_back(std::move(list));
+    }
+
+    std::atomic<const List*> m_list;
+    std::vector<std::unique_ptr<List>> m_retired;
+
+    std::mutex m_mutex;
+    uint32_t m_lastId;
+};
+
+// Lets any number of listeners hook the function at |at|. The function is detoured when the first listener is added
+// and every call walks the current listener list without taking a lock. Adding or removing a listener copies the
+// list and swaps a pointer.
+//
+// Usage:
+//   using ProcessChain = HookChain<0x53E980, void (*)(float)>;
+//   ProcessChain::Get().Add([](ProcessChain::Next& next, float step) { Before(); next(step); After(); });
+//
+// For an address that's only known at runtime, use HookChainTo with a type whose static Get() returns it. Get() is
+// called when a listener is added, until the detour is in place, and a null address fails the install:
+//   static LazyPattern s_process("E8 ? ? ? ? 84 C0 74 12");
+//   struct Process { static MemoryPointer Get() { return s_process.Get(); } };
+//   HookChainTo<Process, void (*)(float)>::Get().Add(...);
+//
+// |Signature| is a function pointer type, __stdcall and __fastcall are supported on x86 MSVC. Hook __thiscall
+// functions as __fastcall with an unused second (edx) argument.
+template <typename Target, typename Signature>
+class HookChainTo;
+
+template <uintptr_t at, typename Signature>
+using HookChain = HookChainTo<LazyPointer<at>, Signature>;
+
+#define HOOK_CHAIN_CONVENTION(convention)                                                                              \
+    template <typename Target, typename Ret, typename... Args>                                                         \
+    class HookChainTo<Target, Ret(convention*)(Args...)> : public HookChainBase<Ret, Args...>                          \
+    {                                                                                                                  \
+    public:                                                                                                            \
+        using Next = typename HookChainBase<Ret, Args...>::Next;                                                       \
+        using Listener = typename HookChainBase<Ret, Args...>::Listener;                                               \
+                                                                                                                       \
+        static HookChainTo& Get()                                                                                      \
+        {                                                                                                              \
+            static HookChainTo chain;                                                                                  \
+            return chain;                                                                                              \
+        }                                                                                                              \
+                                                                                                                       \
+        /* Also installs the detour, if it isn't yet */                                                                \
+        uint32_t Add(Listener listener, int32_t priority = 0)                                                          \
+        {                                                                                                              \
+            const uint32_t id = HookChainBase<Ret, Args...>::Add(std::move(listener), priority);                       \
+            Install();                                                                                                 \
+            return id;                                                                                                 \
+        }                                                                                                              \
+                                                                                                                       \
+        /* Fails if the target can't be found or detoured, every call (and every Add) tries again */                   \
+        bool Install()                                                                                                 \
+        {                                                                                                              \
+            std::lock_guard<std::mutex> lock(m_installMutex);                                                          \
+                                                                                                                       \
+            if (m_installed)                                                                                           \
+            {                                                                                                          \
+                return true;                                                                                           \
+            }                                                                                                          \
+                                                                                                                       \
+            if (!m_detour)                                                                                             \
+            {                                                                                                          \
+                const MemoryPointer target = Target::Get();                                                            \
+                                                                                                                       \
+                if (!target.AsInt())                                                                                   \
+                {                                                                                                      \
+                    return false;                                                                                      \
+                }                                                                                                      \
+                                                                                                                       \
+                m_detour = std::make_unique<Detour>(target, &HookChainTo::Hooked);                                     \
+            }                                                                                                          \
+                                                                                                                       \
+            m_installed = m_detour->Install();                                                                         \
+            return m_installed;                                                                                        \
+        }                                                                                                              \
+                                                                                                                       \
+        bool IsInstalled() const { return m_installed; }                                                               \
+                                                                                                                       \
+    private:                                                                                                           \
+        HookChainTo() : m_installed(false) {}                                                                          \
+                                                                                                                       \
+        static Ret convention Hooked(Args... args) { return Get().Dispatch(&HookChainTo::CallOriginal, args...); }     \
+                                                                                                                       \
+        static Ret CallOriginal(Args... args)                                                                          \
+        {                                                                                                              \
+            return Get().m_detour->template GetOriginal<Ret(convention*)(Args...)>()(args...);                         \
+        }                                                                                                              \
+                                                                                                                       \
+        std::unique_ptr<Detour> m_detour;                                                                              \
+        std::mutex m_installMutex;                                                                                     \
+        std::atomic<bool> m_installed;                                                                                 \
+    };
+
+HOOK_CHAIN_CONVENTION()
+
+#if defined(COMPILER_MSVC) && defined(ARCH_CPU_X86)
+HOOK_CHAIN_CONVENTION(__stdcall)
+HOOK_CHAIN_CONVENTION(__fastcall)
+#endif
+
+#undef HOOK_CHAIN_CONVENTION
+
+}  // namespace hook
@@ -7,6 +7,12 @@
 // https://opensource.org/licenses/MIT)
 
 #include "client/hook/HookFunction.hpp"
+#include "client/hook/LazyPointer.hpp"
+#include "client/hook/WorkerPool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 
 namespace hook
 {
@@ -19,11 +25,116 @@ void HookFunctionBase::Register()
     hookFunctions = this;
 }
 
-void HookFunctionBase::RunAll()
+std::vector<HookFunctionBase*> HookFunctionBase::GetAll()
 {
+    std::vector<HookFunctionBase*> functions;
+
     for (auto func = hookFunctions; func; func = func->m_next)
     {
-        func->Run();
+        functions.push_back(func);
+    }
+
+    return functions;
+}
+
+void HookFunctionBase::RunAll(bool parallel)
+{
+    // Hook functions mostly patch through lazy pointers, resolve all of them up front in one scan
+    LazyPointerBase::ResolveAll();
+
+    std::vector<HookFunctionBase*> functions = GetAll();
+    const size_t count = functions.size();
+
+    // Resolve dependency names to indices once, names nobody registered are ignored
+    std::vector<std::vector<size_t>> dependencies(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        for (const char* name : functions[i]->m_dependencies)
+        {
+            for (size_t j = 0; j < count; j++)
+            {
+                if (j != i && functions[j]->m_name && strcmp(functions[j]->m_name, name) == 0)
+                {
+                    dependencies[i].push_back(j);
+                }
+            }
+        }
+    }
+
+    std::vector<bool> done(count, false);
+    std::vector<size_t> batch;
+    size_t remaining = count;
+
+    while (remaining != 0)
+    {
+        batch.clear();
+
+        int32_t priority = INT32_MAX;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (done[i] || !std::all_of(dependencies[i].begin(), dependencies[i].end(),
+                                [&done](size_t dependency) { return done[dependency]; }))
+            {
+                continue;
+            }
+
+            if (batch.empty() || functions[i]->m_priority < priority)
+            {
+                batch.clear();
+                priority = functions[i]->m_priority;
+            }
+
+            if (functions[i]->m_priority == priority)
+            {
+                batch.push_back(i);
+            }
+        }
+
+        // Only a dependency cycle leaves nothing ready, run what's left one by one in GetAll order
+        const bool cycle = batch.empty();
+
+        if (cycle)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                if (!done[i])
+                {
+                    batch.push_back(i);
+                }
+            }
+        }
+
+        auto run = [&functions, &batch](size_t index)
+        {
+            HookFunctionBase* func = functions[batch[index]];
+
+            const auto start = std::chrono::steady_clock::now();
+            func->Run();
+            const auto end = std::chrono::steady_clock::now();
+
+            func->m_runTime = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+        };
+
+        if (parallel && !cycle)
+        {
+            WorkerPool::Get().ParallelFor(batch.size(), run);
+        }
+        else
+        {
+            for (size_t i = 0; i < batch.size(); i++)
+            {
+                run(i);
+            }
+        }
+
+        for (size_t index : batch)
+        {
+            done[index] = true;
+        }
+
+        remaining -= batch.size();
     }
 }
 
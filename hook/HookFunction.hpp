@@ -8,21 +8,55 @@
 
 #pragma once
 
+#include <stdint.h>
+
+#include <initializer_list>
+#include <vector>
+
 namespace hook
 {
 
 // Initialization function that will be called after the game is loaded.
+//
+// A hook function can be given a name, so others can depend on it, a list of names it depends on and a priority.
+// RunAll orders them as follows:
+//   - A hook function runs after every hook function it depends on finished.
+//   - Of the ones ready to run, those with the lowest priority go first.
+//   - Ties run in the order RunAll always used, the last registered first.
+//   - With RunAll(true), hook functions that are ready at the same time and have the same priority run in parallel
+//     on the worker pool. Only opt in if none of them needs the calling thread (TLS, COM, the main message loop).
+// Anything without a name, dependencies or priority lands in the first batch.
 class HookFunctionBase
 {
 public:
-    HookFunctionBase() { Register(); }
+    HookFunctionBase(const char* name = nullptr, std::initializer_list<const char*> dependencies = {},
+        int32_t priority = 0) :
+        m_name(name), m_dependencies(dependencies), m_priority(priority), m_runTime(0)
+    {
+        Register();
+    }
 
     virtual void Run() = 0;
 
-    static void RunAll();
+    // Runs every registered hook function on the calling thread, or on the shared worker pool if |parallel| is set
+    static void RunAll(bool parallel = false);
     void Register();
 
+    // Every registered hook function, the last registered first
+    static std::vector<HookFunctionBase*> GetAll();
+
+    const char* GetName() const { return m_name; }
+    int32_t GetPriority() const { return m_priority; }
+
+    // Wall time the last Run took, in microseconds
+    uint64_t GetRunTime() const { return m_runTime; }
+
 private:
+    const char* m_name;
+    std::vector<const char*> m_dependencies;
+    int32_t m_priority;
+    uint64_t m_runTime;
+
     HookFunctionBase* m_next;
 };
 
@@ -31,6 +65,13 @@ class HookFunction : public HookFunctionBase
 public:
     HookFunction(void (*function)()) { m_function = function; }
 
+    HookFunction(const char* name, void (*function)(), std::initializer_list<const char*> dependencies = {},
+        int32_t priority = 0) :
+        HookFunctionBase(name, dependencies, priority)
+    {
+        m_function = function;
+    }
+
     virtual void Run() { m_function(); }
 
 private:
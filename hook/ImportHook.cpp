@@ -0,0 +1,396 @@
+// Import table hooks
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#include "client/hook/ImportHook.hpp"
+#include "client/hook/ExecutableMeta.hpp"
+
+#include "build/BuildConfig.hpp"
+
+#if defined(OS_WIN)
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#include <elf.h>
+#include <link.h>
+#endif
+
+#include <cstring>
+
+namespace hook
+{
+
+// A slot of an import, with the symbol version the module requires on ELF
+struct ImportSlot
+{
+    void** slot;
+
+    // Both nullptr on PE and for unversioned symbols
+    const char* version;
+    const char* file;
+};
+
+#if defined(OS_WIN)
+
+static std::vector<ImportSlot> FindImports(void* module, const char* library, const char* function)
+{
+    std::vector<ImportSlot> slots;
+
+    ExecutableMeta meta(module);
+    auto dosHeader = meta.GetRVA<IMAGE_DOS_HEADER>(0);
+    auto ntHeader = meta.GetRVA<IMAGE_NT_HEADERS>(dosHeader->e_lfanew);
+    const IMAGE_DATA_DIRECTORY& directory = ntHeader->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
+
+    if (directory.VirtualAddress == 0)
+    {
+        return slots;
+    }
+
+    for (auto descriptor = meta.GetRVA<IMAGE_IMPORT_DESCRIPTOR>(directory.VirtualAddress); descriptor->Name;
+         descriptor++)
+    {
+        if (library && _stricmp(meta.GetRVA<char>(descriptor->Name), library) != 0)
+        {
+            continue;
+        }
+
+        auto addresses = meta.GetRVA<IMAGE_THUNK_DATA>(descriptor->FirstThunk);
+
+        // Some linkers leave out the name table. The IAT is already resolved by now, so the names are gone from it
+        // too: find the slots by the address the loader put there instead.
+        if (!descriptor->OriginalFirstThunk)
+        {
+            HMODULE module = GetModuleHandleA(meta.GetRVA<char>(descriptor->Name));
+            FARPROC target = module ? GetProcAddress(module, function) : nullptr;
+
+            for (; target && addresses->u1.Function; addresses++)
+            {
+                if (addresses->u1.Function == reinterpret_cast<uintptr_t>(target))
+                {
+                    slots.push_back({reinterpret_cast<void**>(&addresses->u1.Function), nullptr, nullptr});
+                }
+            }
+
+            continue;
+        }
+
+        auto names = meta.GetRVA<IMAGE_THUNK_DATA>(descriptor->OriginalFirstThunk);
+
+        for (; names->u1.AddressOfData; names++, addresses++)
+        {
+            if (IMAGE_SNAP_BY_ORDINAL(names->u1.Ordinal))
+            {
+                continue;
+            }
+
+            auto import = meta.GetRVA<IMAGE_IMPORT_BY_NAME>(names->u1.AddressOfData);
+
+            if (strcmp(reinterpret_cast<const char*>(import->Name), function) == 0)
+            {
+                slots.push_back({reinterpret_cast<void**>(&addresses->u1.Function), nullptr, nullptr});
+            }
+        }
+    }
+
+    return slots;
+}
+
+// The IAT is resolved when the module is loaded
+static void* GetImportTarget(void*, const ImportSlot& import, const char*)
+{
+    return *import.slot;
+}
+
+#else
+
+#if defined(ARCH_CPU_X86_64)
+static const uint32_t kJumpSlot = R_X86_64_JUMP_SLOT;
+static const uint32_t kGlobalData = R_X86_64_GLOB_DAT;
+
+#define HOOK_ELF_R_TYPE ELF64_R_TYPE
+#define HOOK_ELF_R_SYM ELF64_R_SYM
+#else
+static const uint32_t kJumpSlot = R_386_JMP_SLOT;
+static const uint32_t kGlobalData = R_386_GLOB_DAT;
+
+#define HOOK_ELF_R_TYPE ELF32_R_TYPE
+#define HOOK_ELF_R_SYM ELF32_R_SYM
+#endif
+
+// glibc relocates most pointers in the dynamic section, other loaders leave them relative
+static uintptr_t GetDynamicPointer(const ExecutableMeta& meta, ElfW(Addr) value)
+{
+    return value < meta.loadBias() ? meta.loadBias() + value : value;
+}
+
+// Dynamic symbol table of a module, with the symbol versions it requires (.gnu.version and .gnu.version_r)
+struct SymbolTables
+{
+    const ElfW(Sym)* symbols;
+    const char* strings;
+    const ElfW(Half)* versions;
+    uintptr_t needed;
+    size_t neededCount;
+};
+
+// Finds the version (and the library it's required from) |symbol| was linked against, if it has one
+static void GetSymbolVersion(const SymbolTables& tables, size_t symbol, ImportSlot& import)
+{
+    import.version = nullptr;
+    import.file = nullptr;
+
+    // 0 is local and 1 global (unversioned), anything else indexes a requirement or a definition of the module
+    const ElfW(Half) index = tables.versions ? static_cast<ElfW(Half)>(tables.versions[symbol] & 0x7FFF) : 0;
+
+    if (index < 2)
+    {
+        return;
+    }
+
+    uintptr_t need = tables.needed;
+
+    for (size_t i = 0; i < tables.neededCount; i++)
+    {
+        const auto* verneed = reinterpret_cast<const ElfW(Verneed)*>(need);
+        uintptr_t aux = need + verneed->vn_aux;
+
+        for (size_t j = 0; j < verneed->vn_cnt; j++)
+        {
+            const auto* vernaux = reinterpret_cast<const ElfW(Vernaux)*>(aux);
+
+            if ((vernaux->vna_other & 0x7FFF) == index)
+            {
+                import.version = tables.strings + vernaux->vna_name;
+                import.file = tables.strings + verneed->vn_file;
+                return;
+            }
+
+            aux += vernaux->vna_next;
+        }
+
+        need += verneed->vn_next;
+    }
+}
+
+template <typename Rel>
+static void FindRelocations(const ExecutableMeta& meta, uintptr_t table, size_t size, const SymbolTables& tables,
+    const char* library, const char* function, std::vector<ImportSlot>& slots)
+{
+    for (auto rel = reinterpret_cast<const Rel*>(table); rel < reinterpret_cast<const Rel*>(table + size); rel++)
+    {
+        const uint32_t type = HOOK_ELF_R_TYPE(rel->r_info);
+        const size_t symbol = HOOK_ELF_R_SYM(rel->r_info);
+
+        if ((type != kJumpSlot && type != kGlobalData) || symbol == 0 ||
+            strcmp(tables.strings + tables.symbols[symbol].st_name, function) != 0)
+        {
+            continue;
+        }
+
+        ImportSlot import;
+        import.slot = reinterpret_cast<void**>(meta.loadBias() + rel->r_offset);
+        GetSymbolVersion(tables, symbol, import);
+
+        if (library && import.file && strcmp(import.file, library) != 0)
+        {
+            continue;
+        }
+
+        slots.push_back(import);
+    }
+}
+
+static std::vector<ImportSlot> FindImports(void* module, const char* library, const char* function)
+{
+    std::vector<ImportSlot> slots;
+
+    ExecutableMeta meta(module);
+
+    if (meta.dynamic() == 0)
+    {
+        return slots;
+    }
+
+    SymbolTables tables = {};
+    uintptr_t jumpSlots = 0, jumpSlotsSize = 0, jumpSlotsType = DT_NULL;
+    uintptr_t rela = 0, relaSize = 0, rel = 0, relSize = 0;
+
+    for (auto dyn = reinterpret_cast<const ElfW(Dyn)*>(meta.dynamic()); dyn->d_tag != DT_NULL; dyn++)
+    {
+        switch (dyn->d_tag)
+        {
+            case DT_SYMTAB:
+                tables.symbols = reinterpret_cast<const ElfW(Sym)*>(GetDynamicPointer(meta, dyn->d_un.d_ptr));
+                break;
+            case DT_STRTAB:
+                tables.strings = reinterpret_cast<const char*>(GetDynamicPointer(meta, dyn->d_un.d_ptr));
+                break;
+            case DT_VERSYM:
+                tables.versions = reinterpret_cast<const ElfW(Half)*>(GetDynamicPointer(meta, dyn->d_un.d_ptr));
+                break;
+            case DT_VERNEED:
+                tables.needed = GetDynamicPointer(meta, dyn->d_un.d_ptr);
+                break;
+            case DT_VERNEEDNUM:
+                tables.neededCount = dyn->d_un.d_val;
+                break;
+            case DT_JMPREL:
+                jumpSlots = GetDynamicPointer(meta, dyn->d_un.d_ptr);
+                break;
+            case DT_PLTRELSZ:
+                jumpSlotsSize = dyn->d_un.d_val;
+                break;
+            case DT_PLTREL:
+                jumpSlotsType = dyn->d_un.d_val;
+                break;
+            case DT_RELA:
+                rela = GetDynamicPointer(meta, dyn->d_un.d_ptr);
+                break;
+            case DT_RELASZ:
+                relaSize = dyn->d_un.d_val;
+                break;
+            case DT_REL:
+                rel = GetDynamicPointer(meta, dyn->d_un.d_ptr);
+                break;
+            case DT_RELSZ:
+                relSize = dyn->d_un.d_val;
+                break;
+        }
+    }
+
+    if (!tables.symbols || !tables.strings)
+    {
+        return slots;
+    }
+
+    // Calls go through the PLT jump slots, GLOB_DAT covers -fno-plt calls and taken addresses
+    if (jumpSlotsType == DT_RELA)
+    {
+        FindRelocations<ElfW(Rela)>(meta, jumpSlots, jumpSlotsSize, tables, library, function, slots);
+    }
+    else if (jumpSlotsType == DT_REL)
+    {
+        FindRelocations<ElfW(Rel)>(meta, jumpSlots, jumpSlotsSize, tables, library, function, slots);
+    }
+
+    FindRelocations<ElfW(Rela)>(meta, rela, relaSize, tables, library, function, slots);
+    FindRelocations<ElfW(Rel)>(meta, rel, relSize, tables, library, function, slots);
+
+    return slots;
+}
+
+// With lazy binding a jump slot points back into the module's PLT until the first call. Calling that would have the
+// dynamic linker overwrite the slot, so the original is looked up the way the linker would: the global scope first
+// (interposing libraries come before the real one there) with the version the module requires, then the library that
+// version comes from, for modules loaded with RTLD_LOCAL.
+static void* GetImportTarget(void* module, const ImportSlot& import, const char* function)
+{
+    ExecutableMeta meta(module);
+    const uintptr_t target = reinterpret_cast<uintptr_t>(*import.slot);
+
+    for (size_t i = 0; i < meta.rangeCount(); i++)
+    {
+        if (target < meta.ranges()[i].begin || target >= meta.ranges()[i].end)
+        {
+            continue;
+        }
+
+        if (!import.version)
+        {
+            return dlsym(RTLD_DEFAULT, function);
+        }
+
+        void* original = dlvsym(RTLD_DEFAULT, function, import.version);
+
+        if (!original)
+        {
+            if (void* library = dlopen(import.file, RTLD_LAZY | RTLD_NOLOAD))
+            {
+                original = dlvsym(library, function, import.version);
+                dlclose(library);
+            }
+        }
+
+        return original;
+    }
+
+    return *import.slot;
+}
+
+#endif
+
+std::vector<void**> FindImportSlots(void* module, const char* library, const char* function)
+{
+    std::vector<void**> slots;
+
+    for (const ImportSlot& import : FindImports(module, library, function))
+    {
+        slots.push_back(import.slot);
+    }
+
+    return slots;
+}
+
+MemoryPointer HookImport(void* module, const char* library, const char* function, MemoryPointer replacement)
+{
+    void* original = nullptr;
+
+    ImportHookBatch batch(module);
+    batch.Add(library, function, replacement, &original);
+
+    return batch.Commit() ? original : nullptr;
+}
+
+ImportHookBatch& ImportHookBatch::Add(const char* library, const char* function, MemoryPointer replacement,
+    void** original)
+{
+    std::vector<ImportSlot> imports = FindImports(m_module, library, function);
+
+    if (imports.empty())
+    {
+        m_missing = true;
+        return *this;
+    }
+
+    for (const ImportSlot& import : imports)
+    {
+        m_redirects.push_back({import.slot, GetImportTarget(m_module, import, function), original});
+        m_transaction.Write<void*>(import.slot, replacement.Get());
+    }
+
+    return *this;
+}
+
+bool ImportHookBatch::Commit()
+{
+    if (m_missing)
+    {
+        m_transaction.Discard();
+        m_redirects.clear();
+        m_missing = false;
+        return false;
+    }
+
+    // Every slot is a single aligned pointer, so live mode swaps each of them with one atomic write
+    if (!m_transaction.Live().Commit())
+    {
+        return false;
+    }
+
+    for (const Redirect& redirect : m_redirects)
+    {
+        if (redirect.originalOut)
+        {
+            *redirect.originalOut = redirect.original;
+        }
+    }
+
+    m_redirects.clear();
+    return true;
+}
+
+}  // namespace hook
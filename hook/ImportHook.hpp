@@ -0,0 +1,76 @@
+// Import table hooks
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "client/hook/MemoryPointer.hpp"
+#include "client/hook/PatchTransaction.hpp"
+
+namespace hook
+{
+
+// Slots |module| calls |function| through: IAT entries of a PE image, or the GOT entries (.rela.plt jump slots and
+// GLOB_DAT relocations) of an ELF object. |module| is what ExecutableMeta takes. |library| narrows down the search and
+// may be nullptr. On PE it's the DLL name ("kernel32.dll", case insensitive). On ELF only versioned imports are tied
+// to a library, the soname their version is required from ("libc.so.6"), unversioned ones match any |library|.
+std::vector<void**> FindImportSlots(void* module, const char* library, const char* function);
+
+// Points every slot of the import at |replacement| with an atomic write and returns the function it called before,
+// nullptr if the import wasn't found
+MemoryPointer HookImport(void* module, const char* library, const char* function, MemoryPointer replacement);
+
+// Redirects many imports of a module with one protection change per page
+//
+// Usage:
+//   ImportHookBatch batch(module);
+//   batch.Add("user32.dll", "MessageBoxA", &MessageBoxHooked, &s_originalMessageBox);
+//   batch.Add("kernel32.dll", "Sleep", &SleepHooked, &s_originalSleep);
+//   batch.Commit();
+class ImportHookBatch
+{
+public:
+    explicit ImportHookBatch(void* module) : m_module(module), m_missing(false) {}
+
+    // Looks the import up right away, the original function goes to |original| on Commit
+    ImportHookBatch& Add(const char* library, const char* function, MemoryPointer replacement,
+        void** original = nullptr);
+
+    // Typed variant
+    template <typename T>
+    ImportHookBatch& Add(const char* library, const char* function, T replacement, T* original)
+    {
+        return Add(library, function, MemoryPointer(reinterpret_cast<void*>(replacement)),
+            reinterpret_cast<void**>(original));
+    }
+
+    // Fails without writing anything if an import wasn't found or a page couldn't be unprotected
+    bool Commit();
+
+    // Points every committed slot back at its original function
+    bool Rollback() { return m_transaction.Rollback(); }
+
+private:
+    struct Redirect
+    {
+        void** slot;
+        void* original;
+        void** originalOut;
+    };
+
+    void* m_module;
+    std::vector<Redirect> m_redirects;
+    PatchTransaction m_transaction;
+    bool m_missing;
+};
+
+}  // namespace hook
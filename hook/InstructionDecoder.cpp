@@ -0,0 +1,459 @@
+// x86/x64 instruction length decoder
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#include "client/hook/InstructionDecoder.hpp"
+
+#include <cstring>
+
+namespace hook
+{
+
+static const size_t kMaxInstructionLength = 15;
+
+// One bit per opcode
+struct OpcodeTable
+{
+    uint32_t bits[8];
+
+    bool operator[](uint8_t opcode) const { return (bits[opcode >> 5] >> (opcode & 31)) & 1; }
+};
+
+// Bit n of word w is opcode w * 32 + n
+static const OpcodeTable kOneByteModRM = {{
+    0x0F0F0F0F, 0x0F0F0F0F,  // 00-3F: ALU r/m forms
+    0x00000000,              // 40-5F
+    0x00000A0C,              // 60-7F: 62, 63, 69, 6B
+    0x0000FFFF,              // 80-9F: 80-8F
+    0x00000000,              // A0-BF
+    0xFF0F00F3,              // C0-DF: C0, C1, C4-C7, D0-D3, D8-DF
+    0xC0C00000,              // E0-FF: F6, F7, FE, FF
+}};
+
+static const OpcodeTable kTwoByteModRM = {{
+    0xFFFFA00F,  // 00-1F: 00-03, 0D, 0F (3DNow!), 10-1F
+    0x0000FF0F,  // 20-3F: 20-23, 28-2F
+    0xFFFFFFFF,  // 40-5F
+    0xFF7FFFFF,  // 60-7F: all but 77
+    0xFFFF0000,  // 80-9F: 90-9F
+    0xFFFFF838,  // A0-BF: A3-A5, AB-BF
+    0xFFFF00FF,  // C0-DF: C0-C7, D0-DF
+    0xFFFFFFFF,  // E0-FF
+}};
+
+static inline bool InRange(uint8_t value, uint8_t low, uint8_t high)
+{
+    return value >= low && value <= high;
+}
+
+static int64_t ReadSigned(const uint8_t* code, size_t size)
+{
+    switch (size)
+    {
+        case 1:
+            return static_cast<int8_t>(code[0]);
+        case 2:
+        {
+            int16_t value;
+            memcpy(&value, code, sizeof(value));
+            return value;
+        }
+        case 4:
+        {
+            int32_t value;
+            memcpy(&value, code, sizeof(value));
+            return value;
+        }
+        case 8:
+        {
+            int64_t value;
+            memcpy(&value, code, sizeof(value));
+            return value;
+        }
+    }
+
+    return 0;
+}
+
+int64_t Instruction::Displacement(const uint8_t* code) const
+{
+    return ReadSigned(code + dispOffset, dispSize);
+}
+
+int64_t Instruction::Immediate(const uint8_t* code) const
+{
+    return ReadSigned(code + immOffset, immSize);
+}
+
+// Immediate size of a one byte opcode, -1 for invalid ones
+static int OneByteImmediate(uint8_t opcode, const Instruction& out, bool is64Bit)
+{
+    const int operandSize = out.hasOperandSizePrefix ? 2 : 4;
+    const int addressSize = is64Bit ? (out.hasAddressSizePrefix ? 4 : 8) : (out.hasAddressSizePrefix ? 2 : 4);
+
+    if (opcode < 0x40)
+    {
+        // ALU al/eax, imm forms
+        switch (opcode & 7)
+        {
+            case 4:
+                return 1;
+            case 5:
+                return operandSize;
+            case 6:
+            case 7:
+                // push/pop segment and daa/das/aaa/aas are gone in long mode, the rest of the column is prefixes
+                return is64Bit ? -1 : 0;
+        }
+
+        return 0;
+    }
+
+    switch (opcode)
+    {
+        case 0x60:
+        case 0x61:
+        case 0x9A:
+        case 0xC4:
+        case 0xC5:
+        case 0xCE:
+        case 0xD4:
+        case 0xD5:
+        case 0xD6:
+        case 0xEA:
+            if (is64Bit && opcode != 0xC4 && opcode != 0xC5)
+            {
+                return -1;
+            }
+
+            if (opcode == 0x9A || opcode == 0xEA)
+            {
+                return operandSize + 2;  // ptr16:16/32
+            }
+
+            return opcode == 0xD4 || opcode == 0xD5 ? 1 : 0;
+
+        case 0x68:
+        case 0x69:
+        case 0x81:
+        case 0xA9:
+        case 0xC7:
+        case 0xE8:
+        case 0xE9:
+            return operandSize;
+
+        case 0x6A:
+        case 0x6B:
+        case 0x80:
+        case 0x82:
+        case 0x83:
+        case 0xA8:
+        case 0xC0:
+        case 0xC1:
+        case 0xC6:
+        case 0xCD:
+        case 0xE4:
+        case 0xE5:
+        case 0xE6:
+        case 0xE7:
+        case 0xEB:
+            return opcode == 0x82 && is64Bit ? -1 : 1;
+
+        case 0xC2:
+        case 0xCA:
+            return 2;
+
+        case 0xC8:
+            return 3;
+
+        case 0xA0:
+        case 0xA1:
+        case 0xA2:
+        case 0xA3:
+            return addressSize;
+    }
+
+    if (InRange(opcode, 0x70, 0x7F) || InRange(opcode, 0xB0, 0xB7) || InRange(opcode, 0xE0, 0xE3))
+    {
+        return 1;
+    }
+
+    if (InRange(opcode, 0xB8, 0xBF))
+    {
+        return (out.rex & 0x08) ? 8 : operandSize;
+    }
+
+    return 0;
+}
+
+static int TwoByteImmediate(uint8_t opcode, const Instruction& out)
+{
+    if (InRange(opcode, 0x80, 0x8F))
+    {
+        return out.hasOperandSizePrefix ? 2 : 4;
+    }
+
+    switch (opcode)
+    {
+        case 0x0F:  // 3DNow! suffix
+        case 0x70:
+        case 0x71:
+        case 0x72:
+        case 0x73:
+        case 0xA4:
+        case 0xAC:
+        case 0xBA:
+        case 0xC2:
+        case 0xC4:
+        case 0xC5:
+        case 0xC6:
+            return 1;
+    }
+
+    return 0;
+}
+
+static bool DecodeModRM(const uint8_t* code, size_t& pos, Instruction& out, bool is64Bit)
+{
+    if (pos >= kMaxInstructionLength)
+    {
+        return false;
+    }
+
+    out.hasModRM = true;
+    out.modRM = code[pos++];
+
+    const uint8_t mod = out.mod();
+    const uint8_t rm = out.rm();
+
+    if (mod == 3)
+    {
+        return true;
+    }
+
+    // 16 bit addressing only exists outside of long mode
+    if (!is64Bit && out.hasAddressSizePrefix)
+    {
+        out.dispSize = mod == 1 ? 1 : (mod == 2 || (mod == 0 && rm == 6)) ? 2 : 0;
+    }
+    else
+    {
+        uint8_t base = rm;
+
+        if (rm == 4)
+        {
+            if (pos >= kMaxInstructionLength)
+            {
+                return false;
+            }
+
+            base = code[pos++] & 7;
+        }
+
+        if (mod == 1)
+        {
+            out.dispSize = 1;
+        }
+        else if (mod == 2 || (mod == 0 && base == 5))
+        {
+            out.dispSize = 4;
+        }
+
+        out.ripRelative = is64Bit && mod == 0 && rm == 5;
+    }
+
+    out.dispOffset = static_cast<uint8_t>(pos);
+    pos += out.dispSize;
+
+    return true;
+}
+
+bool DecodeInstruction(const uint8_t* code, Instruction& out, bool is64Bit)
+{
+    memset(&out, 0, sizeof(out));
+
+    size_t pos = 0;
+
+    // Legacy prefixes
+    for (;; pos++)
+    {
+        if (pos >= kMaxInstructionLength)
+        {
+            return false;
+        }
+
+        const uint8_t prefix = code[pos];
+
+        if (prefix == 0x66)
+        {
+            out.hasOperandSizePrefix = true;
+        }
+        else if (prefix == 0x67)
+        {
+            out.hasAddressSizePrefix = true;
+        }
+        else if (prefix != 0xF0 && prefix != 0xF2 && prefix != 0xF3 && prefix != 0x2E && prefix != 0x36 &&
+            prefix != 0x3E && prefix != 0x26 && prefix != 0x64 && prefix != 0x65)
+        {
+            break;
+        }
+    }
+
+    // REX has to come right before the opcode
+    if (is64Bit && InRange(code[pos], 0x40, 0x4F))
+    {
+        out.rex = code[pos++];
+    }
+
+    uint8_t opcode = code[pos];
+
+    // VEX and EVEX. Outside of long mode C4, C5 and 62 are LES, LDS and BOUND unless the next byte has mod == 3.
+    const bool vexOrEvex = (opcode == 0xC4 || opcode == 0xC5 || opcode == 0x62) &&
+        (is64Bit || (code[pos + 1] & 0xC0) == 0xC0);
+
+    if (vexOrEvex)
+    {
+        if (out.rex != 0)
+        {
+            return false;
+        }
+
+        uint8_t map;
+
+        if (opcode == 0xC5)
+        {
+            map = Instruction::kMap0F;
+            pos += 2;
+        }
+        else if (opcode == 0xC4)
+        {
+            map = code[pos + 1] & 0x1F;
+            out.rex = 0x40 | ((code[pos + 2] & 0x80) >> 4);  // VEX.W
+            pos += 3;
+        }
+        else
+        {
+            map = code[pos + 1] & 0x03;
+            out.rex = 0x40 | ((code[pos + 2] & 0x80) >> 4);  // EVEX.W
+            pos += 4;
+        }
+
+        if (map < Instruction::kMap0F || map > Instruction::kMap0F3A)
+        {
+            return false;
+        }
+
+        out.opcodeMap = map;
+        out.opcodeOffset = static_cast<uint8_t>(pos);
+        out.opcode = code[pos++];
+
+        // vzeroupper/vzeroall are the only ones without a ModRM
+        if (!(map == Instruction::kMap0F && out.opcode == 0x77))
+        {
+            if (!DecodeModRM(code, pos, out, is64Bit))
+            {
+                return false;
+            }
+        }
+
+        if (map == Instruction::kMap0F3A)
+        {
+            out.immSize = 1;
+        }
+        else if (map == Instruction::kMap0F)
+        {
+            out.immSize = static_cast<uint8_t>(TwoByteImmediate(out.opcode, out));
+        }
+    }
+    else if (opcode == 0x0F)
+    {
+        pos++;
+        opcode = code[pos];
+
+        if (opcode == 0x38 || opcode == 0x3A)
+        {
+            out.opcodeMap = opcode == 0x38 ? Instruction::kMap0F38 : Instruction::kMap0F3A;
+            pos++;
+
+            out.opcodeOffset = static_cast<uint8_t>(pos);
+            out.opcode = code[pos++];
+
+            if (!DecodeModRM(code, pos, out, is64Bit))
+            {
+                return false;
+            }
+
+            out.immSize = out.opcodeMap == Instruction::kMap0F3A ? 1 : 0;
+        }
+        else
+        {
+            out.opcodeMap = Instruction::kMap0F;
+            out.opcodeOffset = static_cast<uint8_t>(pos);
+            out.opcode = code[pos++];
+
+            if (kTwoByteModRM[opcode] && !DecodeModRM(code, pos, out, is64Bit))
+            {
+                return false;
+            }
+
+            out.immSize = static_cast<uint8_t>(TwoByteImmediate(opcode, out));
+            out.relativeBranch = InRange(opcode, 0x80, 0x8F);
+        }
+    }
+    else
+    {
+        out.opcodeMap = Instruction::kMapOneByte;
+        out.opcodeOffset = static_cast<uint8_t>(pos);
+        out.opcode = code[pos++];
+
+        const int immSize = OneByteImmediate(opcode, out, is64Bit);
+
+        if (immSize < 0)
+        {
+            return false;
+        }
+
+        if (kOneByteModRM[opcode] && !DecodeModRM(code, pos, out, is64Bit))
+        {
+            return false;
+        }
+
+        out.immSize = static_cast<uint8_t>(immSize);
+
+        // test r/m, imm hides in the F6/F7 groups
+        if ((opcode == 0xF6 || opcode == 0xF7) && out.reg() < 2)
+        {
+            out.immSize = opcode == 0xF6 ? 1 : (out.hasOperandSizePrefix ? 2 : 4);
+        }
+
+        // Near branches ignore the operand size prefix in long mode
+        if (is64Bit && (opcode == 0xE8 || opcode == 0xE9))
+        {
+            out.immSize = 4;
+        }
+
+        out.relativeBranch = InRange(opcode, 0x70, 0x7F) || InRange(opcode, 0xE0, 0xE3) || opcode == 0xE8 ||
+            opcode == 0xE9 || opcode == 0xEB;
+
+        out.terminator = opcode == 0xC2 || opcode == 0xC3 || opcode == 0xCA || opcode == 0xCB || opcode == 0xCC ||
+            opcode == 0xCF || opcode == 0xE9 || opcode == 0xEA || opcode == 0xEB ||
+            (opcode == 0xFF && (out.reg() == 4 || out.reg() == 5));
+    }
+
+    out.immOffset = static_cast<uint8_t>(pos);
+    pos += out.immSize;
+
+    if (pos > kMaxInstructionLength)
+    {
+        return false;
+    }
+
+    out.length = static_cast<uint8_t>(pos);
+    return true;
+}
+
+}  // namespace hook
@@ -0,0 +1,89 @@
+// x86/x64 instruction length decoder
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "build/BuildConfig.hpp"
+
+namespace hook
+{
+
+// Layout of a decoded instruction. Offsets are from the first byte of the instruction (prefixes included).
+struct Instruction
+{
+    enum OpcodeMap
+    {
+        kMapOneByte,
+        kMap0F,
+        kMap0F38,
+        kMap0F3A
+    };
+
+    uint8_t length;
+
+    uint8_t opcode;
+    uint8_t opcodeMap;
+    uint8_t opcodeOffset;
+
+    bool hasModRM;
+    uint8_t modRM;
+
+    uint8_t dispOffset;
+    uint8_t dispSize;
+
+    uint8_t immOffset;
+    uint8_t immSize;
+
+    bool hasOperandSizePrefix;
+    bool hasAddressSizePrefix;
+    uint8_t rex;
+
+    // [rip + disp32] memory operand, x64 only
+    bool ripRelative;
+
+    // The immediate is a branch displacement (jmp, call, jcc, loop, jecxz)
+    bool relativeBranch;
+
+    // Doesn't fall through to the next instruction (ret, jmp, int3)
+    bool terminator;
+
+    // ModRM fields
+    uint8_t mod() const { return modRM >> 6; }
+    uint8_t reg() const { return (modRM >> 3) & 7; }
+    uint8_t rm() const { return modRM & 7; }
+
+    // Sign extended displacement / immediate
+    int64_t Displacement(const uint8_t* code) const;
+    int64_t Immediate(const uint8_t* code) const;
+
+    // Absolute target of a relative branch or RIP-relative operand, with |code| at |address|
+    uintptr_t BranchTarget(const uint8_t* code, uintptr_t address) const
+    {
+        return address + length + static_cast<uintptr_t>(Immediate(code));
+    }
+
+    uintptr_t RipTarget(const uint8_t* code, uintptr_t address) const
+    {
+        return address + length + static_cast<uintptr_t>(Displacement(code));
+    }
+};
+
+// Decodes the general purpose, x87, SSE/AVX (VEX and EVEX) instruction at |code|. Returns false on invalid or
+// unsupported encodings. Defaults to the mode the library is built for.
+bool DecodeInstruction(const uint8_t* code, Instruction& out,
+#if defined(ARCH_CPU_X86_64)
+    bool is64Bit = true
+#else
+    bool is64Bit = false
+#endif
+);
+
+}  // namespace hook
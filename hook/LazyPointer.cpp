@@ -0,0 +1,109 @@
+// Lazy pointers
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#include "client/hook/LazyPointer.hpp"
+#include "client/hook/PatternBatch.hpp"
+
+#include <mutex>
+#include <vector>
+
+namespace hook
+{
+
+static LazyPointerBase* lazyPointers;
+
+// Function local statics register on first use, possibly on several threads at once
+static std::mutex& GetRegistryMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+void LazyPointerBase::Register()
+{
+    std::lock_guard<std::mutex> lock(GetRegistryMutex());
+
+    m_next = lazyPointers;
+    lazyPointers = this;
+}
+
+void LazyPointerBase::Unregister()
+{
+    std::lock_guard<std::mutex> lock(GetRegistryMutex());
+
+    for (LazyPointerBase** pointer = &lazyPointers; *pointer; pointer = &(*pointer)->m_next)
+    {
+        if (*pointer == this)
+        {
+            *pointer = m_next;
+            break;
+        }
+    }
+}
+
+void LazyPointerBase::ResolveAll()
+{
+    // Held throughout, so no lazy pointer leaves the list while it's walked
+    std::lock_guard<std::mutex> lock(GetRegistryMutex());
+
+    PatternBatch batch;
+    std::vector<std::pair<LazyPointerBase*, Pattern*>> patterns;
+
+    for (auto pointer = lazyPointers; pointer; pointer = pointer->m_next)
+    {
+        if (const char* pattern = pointer->GetPattern())
+        {
+            patterns.emplace_back(pointer, &batch.Add(std::string_view(pattern), 2));
+        }
+        else
+        {
+            pointer->Resolve();
+        }
+    }
+
+    batch.Scan();
+
+    for (auto& entry : patterns)
+    {
+        entry.first->ResolveFrom(*entry.second);
+    }
+}
+
+void LazyPattern::Resolve()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_scanned.load())
+    {
+        PatternBatch batch;
+        Store(batch.Add(std::string_view(m_pattern), 2));
+    }
+}
+
+void LazyPattern::ResolveFrom(Pattern& pattern)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_scanned.load())
+    {
+        Store(pattern);
+    }
+}
+
+void LazyPattern::Store(Pattern& pattern)
+{
+    // A second match means the pattern isn't specific enough, better no pointer than a wrong one
+    if (pattern.CountHint(2).Size() == 1)
+    {
+        m_ptr.store(pattern.Get(0).Get<void>(m_offset), std::memory_order_release);
+    }
+
+    m_scanned.store(true);
+}
+
+}  // namespace hook
@@ -10,11 +10,52 @@
 
 #include <stddef.h>
 
+#include <atomic>
+#include <mutex>
+
 #include "client/hook/MemoryPointer.hpp"
 
 namespace hook
 {
 
+class Pattern;
+
+// Every lazy pointer registers itself here, so all of them can be resolved in one go at startup (ResolveAll, which
+// HookFunctionBase::RunAll calls first). Resolving stays thread-safe either way: the fast path is a single acquire
+// load, the first thread to find it empty resolves and publishes the pointer with a release store.
+//
+// Define HOOK_EAGER_LAZY_POINTERS to drop the check from the fast path entirely. Lazy pointers are then only valid
+// after ResolveAll.
+//
+// A lazy pointer leaves the registry when it's destroyed, which must not happen while ResolveAll runs on another
+// thread.
+class LazyPointerBase
+{
+public:
+    // Resolves every registered lazy pointer that isn't yet, pattern based ones in a single scan
+    static void ResolveAll();
+
+protected:
+    LazyPointerBase() { Register(); }
+    ~LazyPointerBase() { Unregister(); }
+
+    LazyPointerBase(const LazyPointerBase&) = delete;
+    LazyPointerBase& operator=(const LazyPointerBase&) = delete;
+
+    virtual void Resolve() = 0;
+
+    // Pattern based lazy pointers return their pattern until resolved, ResolveAll then scans for it and hands back
+    // the result
+    virtual const char* GetPattern() const { return nullptr; }
+    virtual void ResolveFrom(Pattern&) {}
+
+private:
+    void Register();
+    void Unregister();
+
+    LazyPointerBase* m_next;
+};
+
 template <uintptr_t addr>
 struct LazyPointer
 {
@@ -32,24 +73,104 @@ public:
     }
 
 private:
+    struct Entry : public LazyPointerBase
+    {
+        void Resolve() override { LazyPointer::Resolve(); }
+    };
+
     // Returns the final pointer
     static MemoryPointer xGet()
     {
-        static void* ptr = nullptr;
+        // Keeps the registry entry from being dropped
+        static_cast<void>(&s_entry);
 
-        if (!ptr)
-        {
-            ptr = MemoryPointer(addr).Get();
-        }
+#if defined(HOOK_EAGER_LAZY_POINTERS)
+        return MemoryPointer(s_ptr.load(std::memory_order_relaxed));
+#else
+        void* ptr = s_ptr.load(std::memory_order_acquire);
+        return MemoryPointer(ptr ? ptr : Resolve());
+#endif
+    }
 
-        return MemoryPointer(ptr);
+    static void* Resolve()
+    {
+        // Every thread comes up with the same pointer, so racing here is harmless
+        void* ptr = MemoryPointer(addr).Get();
+        s_ptr.store(ptr, std::memory_order_release);
+        return ptr;
     }
+
+    static std::atomic<void*> s_ptr;
+    static Entry s_entry;
 };
 
+template <uintptr_t addr>
+std::atomic<void*> LazyPointer<addr>::s_ptr(nullptr);
+
+template <uintptr_t addr>
+typename LazyPointer<addr>::Entry LazyPointer<addr>::s_entry;
+
 template <uintptr_t addr>
 inline MemoryPointer LazyPtr()
 {
     return LazyPointer<addr>::Get();
 }
 
-}
+// Lazy pointer to the only match of an IDA style pattern in the process main module, |offset| bytes into it. Meant
+// for static instances. Get returns nullptr if the pattern didn't match.
+//
+// Usage:
+//   static LazyPattern s_processEntity("E8 ? ? ? ? 84 C0 74 12");
+//   MakeCall(s_processEntity.Get(), ProcessEntityHooked);
+class LazyPattern : public LazyPointerBase
+{
+public:
+    // |pattern| has to outlive the lazy pointer, a string literal does
+    explicit LazyPattern(const char* pattern, ptrdiff_t offset = 0) :
+        m_pattern(pattern), m_offset(offset), m_ptr(nullptr), m_scanned(false)
+    {
+    }
+
+    MemoryPointer Get()
+    {
+#if defined(HOOK_EAGER_LAZY_POINTERS)
+        return MemoryPointer(m_ptr.load(std::memory_order_relaxed));
+#else
+        void* ptr = m_ptr.load(std::memory_order_acquire);
+
+        if (!ptr)
+        {
+            Resolve();
+            ptr = m_ptr.load(std::memory_order_acquire);
+        }
+
+        return MemoryPointer(ptr);
+#endif
+    }
+
+    template <typename T>
+    T* Get()
+    {
+        return Get().Get<T>();
+    }
+
+protected:
+    void Resolve() override;
+
+    const char* GetPattern() const override { return m_scanned.load() ? nullptr : m_pattern; }
+    void ResolveFrom(Pattern& pattern) override;
+
+private:
+    void Store(Pattern& pattern);
+
+    const char* m_pattern;
+    ptrdiff_t m_offset;
+
+    std::atomic<void*> m_ptr;
+
+    // Scans only once, even if nothing matched
+    std::atomic<bool> m_scanned;
+    std::mutex m_mutex;
+};
+
+}  // namespace hook
@@ -0,0 +1,492 @@
+// Patching code other threads are running
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#include "client/hook/LivePatch.hpp"
+
+#if defined(OS_WIN)
+#include <windows.h>
+#include <tlhelp32.h>
+#if defined(COMPILER_MSVC)
+#include <intrin.h>
+#endif
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+namespace hook
+{
+
+// How often Park retries when a thread is stopped inside the range
+static const int kParkAttempts = 50;
+
+// How long Park tries in total, a thread that never parks would otherwise stall every attempt
+static const std::chrono::milliseconds kParkTimeout(500);
+
+// Only one parker at a time, two of them would park each other
+static std::mutex parkMutex;
+
+static uint64_t CompareExchange64(volatile uint64_t* address, uint64_t expected, uint64_t desired)
+{
+#if defined(COMPILER_MSVC)
+    return static_cast<uint64_t>(_InterlockedCompareExchange64(reinterpret_cast<volatile long long*>(address),
+        static_cast<long long>(desired), static_cast<long long>(expected)));
+#else
+    return __sync_val_compare_and_swap(address, expected, desired);
+#endif
+}
+
+// Replaces |size| bytes at |offset| into the aligned qword at |qword| with one locked write
+static void WriteWithinQword(uintptr_t qword, size_t offset, const uint8_t* bytes, size_t size)
+{
+    volatile uint64_t* address = reinterpret_cast<volatile uint64_t*>(qword);
+    uint64_t expected = *address;
+
+    for (;;)
+    {
+        uint64_t desired = expected;
+        memcpy(reinterpret_cast<uint8_t*>(&desired) + offset, bytes, size);
+
+        const uint64_t previous = CompareExchange64(address, expected, desired);
+
+        if (previous == expected)
+        {
+            return;
+        }
+
+        expected = previous;
+    }
+}
+
+static void FlushCode(uintptr_t address, size_t size)
+{
+#if defined(OS_WIN)
+    FlushInstructionCache(GetCurrentProcess(), reinterpret_cast<void*>(address), size);
+#else
+    __builtin___clear_cache(reinterpret_cast<char*>(address), reinterpret_cast<char*>(address + size));
+#endif
+}
+
+bool LiveWrite(MemoryPointer at, const void* data, size_t size, bool parkThreads)
+{
+    const uintptr_t address = at.AsInt();
+    const uintptr_t qword = address & ~uintptr_t(7);
+    const size_t offset = address & 7;
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+    if (size == 0)
+    {
+        return true;
+    }
+
+    if (!parkThreads && offset + size <= 8)
+    {
+        WriteWithinQword(qword, offset, bytes, size);
+        FlushCode(address, size);
+        return true;
+    }
+
+    if (!parkThreads && size >= 2 && offset != 7)
+    {
+        // jmp $
+        static const uint8_t kSpin[] = {0xEB, 0xFE};
+
+        WriteWithinQword(qword, offset, kSpin, sizeof(kSpin));
+        FlushCode(address, sizeof(kSpin));
+
+        memcpy(reinterpret_cast<void*>(address + 2), bytes + 2, size - 2);
+        FlushCode(address + 2, size - 2);
+
+        WriteWithinQword(qword, offset, bytes, 2);
+        FlushCode(address, 2);
+        return true;
+    }
+
+    ThreadParker parker;
+
+    if (!parker.Park(address, address + size))
+    {
+        return false;
+    }
+
+    memcpy(reinterpret_cast<void*>(address), bytes, size);
+    FlushCode(address, size);
+    return true;
+}
+
+#if defined(OS_WIN)
+
+ThreadParker::ThreadParker() : m_parked(false)
+{
+}
+
+bool ThreadParker::ParkOnce(uintptr_t begin, uintptr_t end, std::chrono::steady_clock::time_point)
+{
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+
+    if (snapshot == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    const DWORD processId = GetCurrentProcessId();
+    const DWORD threadId = GetCurrentThreadId();
+
+    THREADENTRY32 entry;
+    entry.dwSize = sizeof(entry);
+
+    // A suspended thread may hold the heap lock, so every handle is opened (and stored) before the first one is
+    // suspended
+    for (BOOL next = Thread32First(snapshot, &entry); next; next = Thread32Next(snapshot, &entry))
+    {
+        if (entry.th32OwnerProcessID != processId || entry.th32ThreadID == threadId)
+        {
+            continue;
+        }
+
+        const DWORD access = THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_QUERY_INFORMATION;
+
+        if (HANDLE thread = OpenThread(access, FALSE, entry.th32ThreadID))
+        {
+            m_threads.push_back(thread);
+        }
+    }
+
+    CloseHandle(snapshot);
+
+    bool inside = false;
+    size_t i = 0;
+
+    for (; i < m_threads.size() && !inside; i++)
+    {
+        HANDLE thread = m_threads[i];
+
+        if (SuspendThread(thread) == static_cast<DWORD>(-1))
+        {
+            CloseHandle(thread);
+            m_threads[i] = nullptr;
+            continue;
+        }
+
+        CONTEXT context;
+        context.ContextFlags = CONTEXT_CONTROL;
+
+        if (GetThreadContext(thread, &context))
+        {
+#if defined(ARCH_CPU_X86_64)
+            const uintptr_t ip = context.Rip;
+#else
+            const uintptr_t ip = context.Eip;
+#endif
+            inside = ip >= begin && ip < end;
+        }
+    }
+
+    // Threads after the one found inside were never suspended
+    for (; i < m_threads.size(); i++)
+    {
+        CloseHandle(m_threads[i]);
+        m_threads[i] = nullptr;
+    }
+
+    if (inside)
+    {
+        Unpark();
+        return false;
+    }
+
+    return true;
+}
+
+void ThreadParker::Unpark()
+{
+    for (HANDLE thread : m_threads)
+    {
+        if (thread)
+        {
+            ResumeThread(thread);
+            CloseHandle(thread);
+        }
+    }
+
+    m_threads.clear();
+}
+
+#elif defined(OS_LINUX)
+
+// Parked threads wait in a signal handler, leaving where they were stopped behind
+static const size_t kMaxParkedThreads = 1024;
+
+static std::atomic<bool> parkHold;
+static std::atomic<size_t> parkedCount;
+static std::atomic<size_t> parkedSlots;
+static std::atomic<uintptr_t> parkedIps[kMaxParkedThreads];
+
+// Threads signalled by the current ParkOnce, and the latest listing of /proc/self/task
+static pid_t signalledIds[kMaxParkedThreads];
+static pid_t taskIds[kMaxParkedThreads];
+
+static int GetParkSignal()
+{
+    return SIGRTMIN + 3;
+}
+
+static void ParkHandler(int, siginfo_t*, void* context)
+{
+    const int savedErrno = errno;
+
+    const ucontext_t* ucontext = static_cast<const ucontext_t*>(context);
+#if defined(ARCH_CPU_X86_64)
+    const uintptr_t ip = static_cast<uintptr_t>(ucontext->uc_mcontext.gregs[REG_RIP]);
+#else
+    const uintptr_t ip = static_cast<uintptr_t>(ucontext->uc_mcontext.gregs[REG_EIP]);
+#endif
+
+    const size_t slot = parkedSlots.fetch_add(1);
+
+    if (slot < kMaxParkedThreads)
+    {
+        parkedIps[slot].store(ip, std::memory_order_relaxed);
+    }
+
+    parkedCount.fetch_add(1, std::memory_order_release);
+
+    while (parkHold.load(std::memory_order_acquire))
+    {
+        sched_yield();
+    }
+
+    parkedCount.fetch_sub(1, std::memory_order_release);
+
+    errno = savedErrno;
+}
+
+// Lists the threads of the process into |ids| with raw syscalls and no heap, as a parked thread may hold the malloc
+// lock. Returns SIZE_MAX if the listing couldn't be read or didn't fit.
+static size_t ReadTaskIds(pid_t (&ids)[kMaxParkedThreads])
+{
+    const int fd = open("/proc/self/task", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        return SIZE_MAX;
+    }
+
+    alignas(dirent64) char buffer[4096];
+    size_t count = 0;
+    bool complete = true;
+
+    for (;;)
+    {
+        const long size = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+
+        if (size <= 0)
+        {
+            complete = complete && size == 0;
+            break;
+        }
+
+        for (long position = 0; position < size;)
+        {
+            const dirent64* entry = reinterpret_cast<const dirent64*>(buffer + position);
+            const pid_t id = static_cast<pid_t>(atoi(entry->d_name));
+
+            if (id > 0 && count < kMaxParkedThreads)
+            {
+                ids[count++] = id;
+            }
+            else if (id > 0)
+            {
+                complete = false;
+            }
+
+            position += entry->d_reclen;
+        }
+    }
+
+    close(fd);
+    return complete ? count : SIZE_MAX;
+}
+
+ThreadParker::ThreadParker() : m_parked(false)
+{
+    static std::once_flag handlerOnce;
+
+    std::call_once(handlerOnce, []()
+    {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+
+        action.sa_sigaction = ParkHandler;
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigfillset(&action.sa_mask);
+
+        sigaction(GetParkSignal(), &action, nullptr);
+    });
+}
+
+bool ThreadParker::ParkOnce(uintptr_t begin, uintptr_t end, std::chrono::steady_clock::time_point deadline)
+{
+    const pid_t processId = getpid();
+    const pid_t threadId = static_cast<pid_t>(syscall(SYS_gettid));
+
+    parkedSlots.store(0);
+    parkHold.store(true, std::memory_order_release);
+
+    size_t signalled = 0;
+
+    // Threads started before the others were parked only show up in a later listing, so list until none is new
+    for (bool added = true; added;)
+    {
+        const size_t count = ReadTaskIds(taskIds);
+
+        if (count == SIZE_MAX)
+        {
+            Unpark();
+            return false;
+        }
+
+        added = false;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const pid_t id = taskIds[i];
+
+            if (id == threadId || std::find(signalledIds, signalledIds + signalled, id) != signalledIds + signalled)
+            {
+                continue;
+            }
+
+            if (signalled == kMaxParkedThreads)
+            {
+                Unpark();
+                return false;
+            }
+
+            if (syscall(SYS_tgkill, processId, id, GetParkSignal()) == 0)
+            {
+                signalledIds[signalled++] = id;
+                added = true;
+            }
+        }
+
+        // A thread that exits before handling the signal, or blocks it, never shows up
+        while (parkedCount.load(std::memory_order_acquire) < signalled)
+        {
+            if (std::chrono::steady_clock::now() > deadline)
+            {
+                Unpark();
+                return false;
+            }
+
+            std::this_thread::yield();
+        }
+    }
+
+    const size_t slots = parkedSlots.load();
+    bool inside = slots > kMaxParkedThreads;
+
+    for (size_t i = 0; i < slots && i < kMaxParkedThreads && !inside; i++)
+    {
+        const uintptr_t ip = parkedIps[i].load(std::memory_order_relaxed);
+        inside = ip >= begin && ip < end;
+    }
+
+    if (inside)
+    {
+        Unpark();
+        return false;
+    }
+
+    return true;
+}
+
+void ThreadParker::Unpark()
+{
+    parkHold.store(false, std::memory_order_release);
+
+    // Let everyone leave the handler before it can be armed again
+    while (parkedCount.load(std::memory_order_acquire) != 0)
+    {
+        std::this_thread::yield();
+    }
+}
+
+#else
+
+ThreadParker::ThreadParker() : m_parked(false)
+{
+}
+
+// No way to stop other threads here, so nothing is parked and LiveWrite writes straight away
+bool ThreadParker::ParkOnce(uintptr_t, uintptr_t, std::chrono::steady_clock::time_point)
+{
+    return true;
+}
+
+void ThreadParker::Unpark()
+{
+}
+
+#endif
+
+ThreadParker::~ThreadParker()
+{
+    Release();
+}
+
+bool ThreadParker::Park(uintptr_t begin, uintptr_t end)
+{
+    if (m_parked)
+    {
+        return true;
+    }
+
+    parkMutex.lock();
+
+    const auto deadline = std::chrono::steady_clock::now() + kParkTimeout;
+
+    for (int attempt = 0; attempt < kParkAttempts && std::chrono::steady_clock::now() < deadline; attempt++)
+    {
+        if (ParkOnce(begin, end, deadline))
+        {
+            m_parked = true;
+            return true;
+        }
+
+        std::this_thread::yield();
+    }
+
+    parkMutex.unlock();
+    return false;
+}
+
+void ThreadParker::Release()
+{
+    if (m_parked)
+    {
+        Unpark();
+        m_parked = false;
+        parkMutex.unlock();
+    }
+}
+
+}  // namespace hook
@@ -0,0 +1,63 @@
+// Patching code other threads are running
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <vector>
+
+#include "build/BuildConfig.hpp"
+#include "client/hook/MemoryPointer.hpp"
+
+namespace hook
+{
+
+// Writes |size| bytes of code at |at| (already writable) so that no other thread can fetch a half written
+// instruction:
+//   - Up to 8 bytes within an aligned qword are swapped in with a single cmpxchg.
+//   - Longer patches first turn the first two bytes into "jmp $" (EB FE), so threads arriving there spin, write the
+//     tail, then swap in the real first two bytes.
+//   - Anything else is written with every other thread parked outside of the patched bytes.
+// The first two ways assume no thread can be stopped inside the patched bytes, which only holds when they replace a
+// single instruction (or an aligned pointer). A thread preempted after the first instruction of a multi-instruction
+// patch, like a detoured prologue, would resume in the middle of the new code. Pass |parkThreads| for those, it
+// always takes the third way. Threads can only be parked on Windows and Linux, elsewhere the third way writes
+// without parking anything, which is only safe while no other thread runs the patched code.
+bool LiveWrite(MemoryPointer at, const void* data, size_t size, bool parkThreads = false);
+
+// Stops every other thread of the process until destroyed, on Windows and Linux
+class ThreadParker
+{
+public:
+    ThreadParker();
+    ~ThreadParker();
+
+    ThreadParker(const ThreadParker&) = delete;
+    ThreadParker& operator=(const ThreadParker&) = delete;
+
+    // Parks the other threads, retrying for up to half a second while any of them is stopped in [begin, end) or
+    // doesn't park. Returns false if that didn't work out, with nothing parked.
+    bool Park(uintptr_t begin, uintptr_t end);
+
+    void Release();
+
+private:
+    bool ParkOnce(uintptr_t begin, uintptr_t end, std::chrono::steady_clock::time_point deadline);
+    void Unpark();
+
+#if defined(OS_WIN)
+    std::vector<void*> m_threads;
+#endif
+
+    bool m_parked;
+};
+
+}  // namespace hook
@@ -0,0 +1,211 @@
+// Executable images mapped from disk
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#include "client/hook/MappedImage.hpp"
+
+#if defined(OS_WIN)
+#include <windows.h>
+#else
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace hook
+{
+
+#if defined(OS_WIN)
+
+MappedImage::MappedImage() :
+    m_base(nullptr),
+    m_size(0),
+    m_file(nullptr),
+    m_mapping(nullptr)
+{
+}
+
+bool MappedImage::Open(const char* path)
+{
+    Close();
+
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+        nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    m_file = file;
+
+    // The image loader does the section layout, and the sections stay backed by the file
+    m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY | SEC_IMAGE, 0, 0, nullptr);
+    m_base = m_mapping ? MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+    if (!m_base)
+    {
+        Close();
+        return false;
+    }
+
+    // SizeOfImage is at the same offset in PE32 and PE32+ headers
+    PIMAGE_DOS_HEADER dosHeader = static_cast<PIMAGE_DOS_HEADER>(m_base);
+    PIMAGE_NT_HEADERS ntHeader =
+        reinterpret_cast<PIMAGE_NT_HEADERS>(static_cast<uint8_t*>(m_base) + dosHeader->e_lfanew);
+
+    m_size = ntHeader->OptionalHeader.SizeOfImage;
+    return true;
+}
+
+void MappedImage::Close()
+{
+    if (m_base)
+    {
+        UnmapViewOfFile(m_base);
+    }
+
+    if (m_mapping)
+    {
+        CloseHandle(m_mapping);
+    }
+
+    if (m_file)
+    {
+        CloseHandle(m_file);
+    }
+
+    m_base = nullptr;
+    m_size = 0;
+    m_mapping = nullptr;
+    m_file = nullptr;
+}
+
+#else
+
+#if defined(ARCH_CPU_X86_64)
+static const uint8_t kElfClass = ELFCLASS64;
+#else
+static const uint8_t kElfClass = ELFCLASS32;
+#endif
+
+MappedImage::MappedImage() :
+    m_base(nullptr),
+    m_size(0)
+{
+}
+
+bool MappedImage::Open(const char* path)
+{
+    Close();
+
+    const int file = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (file < 0)
+    {
+        return false;
+    }
+
+    ElfW(Ehdr) header;
+    std::vector<ElfW(Phdr)> phdrs;
+
+    bool valid = pread(file, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)) &&
+        memcmp(header.e_ident, ELFMAG, SELFMAG) == 0 && header.e_ident[EI_CLASS] == kElfClass &&
+        header.e_phentsize == sizeof(ElfW(Phdr));
+
+    if (valid)
+    {
+        phdrs.resize(header.e_phnum);
+
+        const ssize_t size = static_cast<ssize_t>(phdrs.size() * sizeof(ElfW(Phdr)));
+        valid = pread(file, phdrs.data(), static_cast<size_t>(size), static_cast<off_t>(header.e_phoff)) == size;
+    }
+
+    const uintptr_t pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    uintptr_t lowest = UINTPTR_MAX;
+    uintptr_t highest = 0;
+
+    for (const ElfW(Phdr)& phdr : phdrs)
+    {
+        if (phdr.p_type == PT_LOAD)
+        {
+            lowest = std::min<uintptr_t>(lowest, phdr.p_vaddr & ~(pageSize - 1));
+            highest = std::max<uintptr_t>(highest, (phdr.p_vaddr + phdr.p_memsz + pageSize - 1) & ~(pageSize - 1));
+        }
+    }
+
+    // Reserve the whole span first, so the segments land at the same distances they were linked at. What's left
+    // over (bss) reads as zeros.
+    void* memory = valid && lowest < highest ?
+        mmap(nullptr, highest - lowest, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) : MAP_FAILED;
+
+    if (memory == MAP_FAILED)
+    {
+        close(file);
+        return false;
+    }
+
+    m_base = memory;
+    m_size = highest - lowest;
+
+    for (const ElfW(Phdr)& phdr : phdrs)
+    {
+        if (phdr.p_type != PT_LOAD || phdr.p_filesz == 0)
+        {
+            continue;
+        }
+
+        const uintptr_t pageOffset = phdr.p_vaddr & (pageSize - 1);
+        void* at = static_cast<uint8_t*>(memory) + (phdr.p_vaddr - pageOffset - lowest);
+
+        if (mmap(at, phdr.p_filesz + pageOffset, PROT_READ, MAP_PRIVATE | MAP_FIXED, file,
+                static_cast<off_t>(phdr.p_offset - pageOffset)) == MAP_FAILED)
+        {
+            valid = false;
+            break;
+        }
+    }
+
+    close(file);
+
+    // ExecutableMeta finds the program headers through the ELF header, the first segment has to hold both
+    const uint8_t* image = static_cast<const uint8_t*>(m_base);
+
+    if (!valid || memcmp(image, ELFMAG, SELFMAG) != 0 || header.e_phoff + phdrs.size() * sizeof(ElfW(Phdr)) > m_size)
+    {
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+void MappedImage::Close()
+{
+    if (m_base)
+    {
+        munmap(m_base, m_size);
+    }
+
+    m_base = nullptr;
+    m_size = 0;
+}
+
+#endif
+
+MappedImage::~MappedImage()
+{
+    Close();
+}
+
+}  // namespace hook
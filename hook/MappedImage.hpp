@@ -0,0 +1,74 @@
+// Executable images mapped from disk
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "build/BuildConfig.hpp"
+#include "client/hook/Pattern.hpp"
+
+namespace hook
+{
+
+// Maps a PE (Windows) or ELF (everywhere else) image from disk with its sections at their virtual addresses, backed
+// by the file instead of copied. The base can be handed to anything that takes a module (ModulePattern,
+// PatternBatch, XrefIndex, StringIndex), so signatures can be checked against a binary without running it, and with
+// a PatternCache open the results are stored for the real thing. Nothing is relocated or imported and nothing may be
+// executed: absolute addresses in the code still refer to the preferred base.
+//
+// Usage:
+//   MappedImage image;
+//   if (image.Open("gta_sa.exe"))
+//   {
+//       PatternBatch batch(image.GetBase());
+//       Pattern& a = batch.Add("E8 ? ? ? ? 84 C0 74 12");
+//       batch.Scan();
+//       uintptr_t rva = image.ToRVA(a.Count(1).Get(0));
+//   }
+class MappedImage
+{
+public:
+    MappedImage();
+    ~MappedImage();
+
+    MappedImage(const MappedImage&) = delete;
+    MappedImage& operator=(const MappedImage&) = delete;
+
+    // Maps the image at |path|, closing the one mapped before. ELF images have to be of the same class as the
+    // process, PE images of either.
+    bool Open(const char* path);
+
+    void Close();
+
+    bool IsOpen() const { return m_base != nullptr; }
+
+    // Where the image (its headers) got mapped
+    void* GetBase() const { return m_base; }
+
+    // Size of the image in memory
+    size_t GetSize() const { return m_size; }
+
+    // Offset of |match| from the base
+    uintptr_t ToRVA(const PatternMatch& match) const
+    {
+        return reinterpret_cast<uintptr_t>(match.Get<void>()) - reinterpret_cast<uintptr_t>(m_base);
+    }
+
+private:
+    void* m_base;
+    size_t m_size;
+
+#if defined(OS_WIN)
+    void* m_file;
+    void* m_mapping;
+#endif
+};
+
+}  // namespace hook
@@ -9,6 +9,9 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
+
+#include <cstddef>
 
 namespace hook
 {
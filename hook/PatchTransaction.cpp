@@ -0,0 +1,454 @@
+// Batched code patching
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#include "client/hook/PatchTransaction.hpp"
+#include "client/hook/ExecutableArena.hpp"
+#include "client/hook/LivePatch.hpp"
+
+#include "build/BuildConfig.hpp"
+
+#if defined(OS_WIN)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+namespace hook
+{
+
+struct UnprotectedPage
+{
+    uintptr_t address;
+    uint32_t oldProtect;
+};
+
+std::recursive_mutex& GetPatchMutex()
+{
+    static std::recursive_mutex mutex;
+    return mutex;
+}
+
+static uintptr_t GetPageSize()
+{
+#if defined(OS_WIN)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+#if defined(OS_WIN)
+static bool UnprotectPage(uintptr_t page, uintptr_t pageSize, uint32_t& oldProtect)
+{
+    DWORD protect;
+    bool result = !!VirtualProtect(reinterpret_cast<void*>(page), pageSize, PAGE_EXECUTE_READWRITE, &protect);
+    oldProtect = protect;
+    return result;
+}
+
+static void ProtectPage(uintptr_t page, uintptr_t pageSize, uint32_t protect)
+{
+    DWORD oldProtect;
+    VirtualProtect(reinterpret_cast<void*>(page), pageSize, protect, &oldProtect);
+}
+#else
+struct PageState
+{
+    // PROT_* flags the page has outside of patching
+    int protection;
+
+    // UnprotectPage calls not yet matched by a ProtectPage
+    uint32_t unprotects;
+};
+
+// Every page seen so far, only touched with the patch mutex held
+static std::unordered_map<uintptr_t, PageState> pageStates;
+
+// Reads the current protection of each of the sorted page addresses |pages| from /proc/self/maps, in a single pass.
+// There's no syscall that returns it. Pages missing from the maps are reported as r-x.
+static std::vector<int> QueryProtection(const std::vector<uintptr_t>& pages)
+{
+    std::vector<int> protections(pages.size(), PROT_READ | PROT_EXEC);
+
+    FILE* maps = fopen("/proc/self/maps", "r");
+
+    if (!maps)
+    {
+        return protections;
+    }
+
+    char line[512];
+    size_t next = 0;
+
+    while (next < pages.size() && fgets(line, sizeof(line), maps))
+    {
+        unsigned long begin, end;
+        char perms[5];
+
+        if (sscanf(line, "%lx-%lx %4s", &begin, &end, perms) != 3)
+        {
+            continue;
+        }
+
+        while (next < pages.size() && pages[next] < begin)
+        {
+            next++;
+        }
+
+        for (; next < pages.size() && pages[next] < end; next++)
+        {
+            protections[next] = (perms[0] == 'r' ? PROT_READ : 0) | (perms[1] == 'w' ? PROT_WRITE : 0) |
+                (perms[2] == 'x' ? PROT_EXEC : 0);
+        }
+    }
+
+    fclose(maps);
+    return protections;
+}
+
+// Reads the protection of those of the sorted |pages| that weren't seen before
+static void LoadPageStates(const std::vector<uintptr_t>& pages)
+{
+    std::vector<uintptr_t> unknown;
+
+    for (uintptr_t page : pages)
+    {
+        if (pageStates.find(page) == pageStates.end())
+        {
+            unknown.push_back(page);
+        }
+    }
+
+    if (unknown.empty())
+    {
+        return;
+    }
+
+    const std::vector<int> protections = QueryProtection(unknown);
+
+    for (size_t i = 0; i < unknown.size(); i++)
+    {
+        pageStates[unknown[i]] = {protections[i], 0};
+    }
+}
+
+// Only the first of nested calls changes the protection, the page's own one is already known
+static bool UnprotectPage(uintptr_t page, uintptr_t pageSize, uint32_t&)
+{
+    PageState& state = pageStates[page];
+
+    if (state.unprotects == 0 &&
+        mprotect(reinterpret_cast<void*>(page), pageSize, PROT_READ | PROT_WRITE | PROT_EXEC) != 0)
+    {
+        return false;
+    }
+
+    state.unprotects++;
+    return true;
+}
+
+static void ProtectPage(uintptr_t page, uintptr_t pageSize, uint32_t)
+{
+    PageState& state = pageStates[page];
+
+    if (state.unprotects != 0 && --state.unprotects == 0)
+    {
+        mprotect(reinterpret_cast<void*>(page), pageSize, state.protection);
+    }
+}
+
+bool UnprotectPages(const std::vector<uintptr_t>& pages)
+{
+    static const uintptr_t pageSize = GetPageSize();
+
+    std::lock_guard<std::recursive_mutex> lock(GetPatchMutex());
+    LoadPageStates(pages);
+
+    uint32_t unused = 0;
+
+    for (size_t i = 0; i < pages.size(); i++)
+    {
+        if (!UnprotectPage(pages[i], pageSize, unused))
+        {
+            while (i-- != 0)
+            {
+                ProtectPage(pages[i], pageSize, unused);
+            }
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void RestorePages(const std::vector<uintptr_t>& pages)
+{
+    static const uintptr_t pageSize = GetPageSize();
+
+    std::lock_guard<std::recursive_mutex> lock(GetPatchMutex());
+
+    for (uintptr_t page : pages)
+    {
+        ProtectPage(page, pageSize, 0);
+    }
+}
+
+bool SetPageProtection(const std::vector<uintptr_t>& pages, int protection, int* oldProtection)
+{
+    static const uintptr_t pageSize = GetPageSize();
+
+    std::lock_guard<std::recursive_mutex> lock(GetPatchMutex());
+    LoadPageStates(pages);
+
+    if (oldProtection && !pages.empty())
+    {
+        *oldProtection = pageStates[pages[0]].protection;
+    }
+
+    bool result = true;
+
+    for (uintptr_t page : pages)
+    {
+        PageState& state = pageStates[page];
+        state.protection = protection;
+
+        // Pages being patched get it once that's done
+        if (state.unprotects == 0)
+        {
+            result = mprotect(reinterpret_cast<void*>(page), pageSize, protection) == 0 && result;
+        }
+    }
+
+    return result;
+}
+#endif
+
+PatchTransaction& PatchTransaction::Fill(MemoryPointer at, uint8_t value, size_t size)
+{
+    if (size != 0)
+    {
+        memset(Queue(at.AsInt(), size), value, size);
+    }
+
+    return *this;
+}
+
+PatchTransaction& PatchTransaction::MemCpy(MemoryPointer at, const void* src, size_t size)
+{
+    if (size != 0)
+    {
+        memcpy(Queue(at.AsInt(), size), src, size);
+    }
+
+    return *this;
+}
+
+PatchTransaction& PatchTransaction::MakeBranch(uint8_t opcode, MemoryPointer at, MemoryPointer dest)
+{
+    if (!IsRel32Reachable(at.AsInt() + 5, dest.AsInt()))
+    {
+        dest = ExecutableArena::Get().GetJumpThunk(at.AsInt(), dest.AsInt());
+
+        if (!dest.AsInt())
+        {
+            m_failed = true;
+            return *this;
+        }
+    }
+
+    const uint32_t offset = static_cast<uint32_t>(dest.AsInt() - (at.AsInt() + 5));
+    uint8_t* data = Queue(at.AsInt(), 5);
+
+    data[0] = opcode;
+    memcpy(data + 1, &offset, sizeof(offset));
+
+    return *this;
+}
+
+uint8_t* PatchTransaction::Queue(uintptr_t address, size_t size)
+{
+    m_pending.push_back({address, size, m_pendingData.size()});
+    m_pendingData.resize(m_pendingData.size() + size);
+
+    return &m_pendingData[m_pending.back().offset];
+}
+
+bool PatchTransaction::Commit()
+{
+    if (m_failed)
+    {
+        return false;
+    }
+
+    // A patch that matches the current memory is only redundant if no other patch in the batch overlaps it
+    std::vector<size_t> order(m_pending.size());
+
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+
+    std::sort(order.begin(), order.end(),
+        [this](size_t a, size_t b) { return m_pending[a].address < m_pending[b].address; });
+
+    std::vector<bool> needed(m_pending.size(), true);
+    uintptr_t previousEnd = 0;
+
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        const Patch& patch = m_pending[order[i]];
+
+        const bool overlapsPrevious = previousEnd > patch.address;
+        const bool overlapsNext = i + 1 < order.size() && patch.address + patch.size > m_pending[order[i + 1]].address;
+
+        previousEnd = std::max(previousEnd, patch.address + patch.size);
+
+        if (!overlapsPrevious && !overlapsNext &&
+            !memcmp(reinterpret_cast<const void*>(patch.address), &m_pendingData[patch.offset], patch.size))
+        {
+            needed[order[i]] = false;
+        }
+    }
+
+    std::vector<Patch> patches;
+
+    for (size_t i = 0; i < m_pending.size(); i++)
+    {
+        if (needed[i])
+        {
+            patches.push_back(m_pending[i]);
+        }
+    }
+
+    if (!Apply(patches, m_pendingData, &m_undo, &m_undoData))
+    {
+        return false;
+    }
+
+    Discard();
+    return true;
+}
+
+bool PatchTransaction::Rollback()
+{
+    Discard();
+
+    // Undo in reverse, so overlapping patches end up with the oldest bytes
+    std::vector<Patch> patches(m_undo.rbegin(), m_undo.rend());
+
+    if (!Apply(patches, m_undoData, nullptr, nullptr))
+    {
+        return false;
+    }
+
+    m_undo.clear();
+    m_undoData.clear();
+    return true;
+}
+
+void PatchTransaction::Discard()
+{
+    m_pending.clear();
+    m_pendingData.clear();
+    m_failed = false;
+}
+
+bool PatchTransaction::Apply(const std::vector<Patch>& patches, const std::vector<uint8_t>& data,
+    std::vector<Patch>* undo, std::vector<uint8_t>* undoData)
+{
+    static const uintptr_t pageSize = GetPageSize();
+
+    std::lock_guard<std::recursive_mutex> lock(GetPatchMutex());
+
+    std::vector<UnprotectedPage> pages;
+
+    for (const Patch& patch : patches)
+    {
+        for (uintptr_t page = patch.address & ~(pageSize - 1); page < patch.address + patch.size; page += pageSize)
+        {
+            pages.push_back({page, 0});
+        }
+    }
+
+    std::sort(pages.begin(), pages.end(),
+        [](const UnprotectedPage& a, const UnprotectedPage& b) { return a.address < b.address; });
+    pages.erase(std::unique(pages.begin(), pages.end(),
+                    [](const UnprotectedPage& a, const UnprotectedPage& b) { return a.address == b.address; }),
+        pages.end());
+
+#if !defined(OS_WIN)
+    std::vector<uintptr_t> addresses;
+
+    for (const UnprotectedPage& page : pages)
+    {
+        addresses.push_back(page.address);
+    }
+
+    LoadPageStates(addresses);
+#endif
+
+    for (size_t i = 0; i < pages.size(); i++)
+    {
+        if (!UnprotectPage(pages[i].address, pageSize, pages[i].oldProtect))
+        {
+            while (i-- != 0)
+            {
+                ProtectPage(pages[i].address, pageSize, pages[i].oldProtect);
+            }
+
+            return false;
+        }
+    }
+
+    bool written = true;
+
+    for (const Patch& patch : patches)
+    {
+        if (undo)
+        {
+            const uint8_t* original = reinterpret_cast<const uint8_t*>(patch.address);
+
+            undo->push_back({patch.address, patch.size, undoData->size()});
+            undoData->insert(undoData->end(), original, original + patch.size);
+        }
+
+        if (!m_live)
+        {
+            memcpy(reinterpret_cast<void*>(patch.address), &data[patch.offset], patch.size);
+        }
+        else if (!LiveWrite(patch.address, &data[patch.offset], patch.size, m_parkThreads))
+        {
+            if (undo)
+            {
+                undoData->resize(undo->back().offset);
+                undo->pop_back();
+            }
+
+            written = false;
+            break;
+        }
+    }
+
+    for (const UnprotectedPage& page : pages)
+    {
+        ProtectPage(page.address, pageSize, page.oldProtect);
+    }
+
+    return written;
+}
+
+}  // namespace hook
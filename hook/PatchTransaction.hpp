@@ -0,0 +1,129 @@
+// Batched code patching
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <vector>
+
+#include "build/BuildConfig.hpp"
+#include "client/hook/MemoryPointer.hpp"
+
+namespace hook
+{
+
+// Held while code pages are unprotected and written, by transactions and ScopedUnprotect alike. Two writers
+// unprotecting the same page at once would otherwise save each other's temporary protection as the old one.
+std::recursive_mutex& GetPatchMutex();
+
+#if !defined(OS_WIN)
+// The protection (PROT_* flags) of a code page is read from /proc/self/maps the first time it's patched, as there's no
+// syscall that returns it, and remembered from then on. Changes made other than through SetPageProtection (or
+// ProtectMemory) aren't seen.
+
+// Makes the sorted, distinct |pages| writable and executable until the matching RestorePages, which gives each page
+// its own protection back. Calls nest, only the outermost one changes the protection.
+bool UnprotectPages(const std::vector<uintptr_t>& pages);
+void RestorePages(const std::vector<uintptr_t>& pages);
+
+// Sets the protection of |pages|, pages being patched get it once that's done. |oldProtection| receives the one the
+// first page had.
+bool SetPageProtection(const std::vector<uintptr_t>& pages, int protection, int* oldProtection = nullptr);
+#endif
+
+// Queues patches and applies them in one go: every touched page is unprotected once, all patches are written, then
+// every page gets its old protection back. The original bytes are kept, so everything committed through the
+// transaction can be rolled back.
+//
+// Usage:
+//   PatchTransaction transaction;
+//   transaction.MakeJmp(0x401000, MyFunction).MakeNop(0x402000, 5).Write<uint8_t>(0x403000, 0xC3);
+//   transaction.Commit();
+class PatchTransaction
+{
+public:
+    PatchTransaction() : m_live(false), m_parkThreads(false), m_failed(false) {}
+
+    PatchTransaction(const PatchTransaction&) = delete;
+    PatchTransaction& operator=(const PatchTransaction&) = delete;
+
+    template <typename T>
+    PatchTransaction& Write(MemoryPointer at, T value)
+    {
+        return MemCpy(at, &value, sizeof(T));
+    }
+
+    PatchTransaction& Fill(MemoryPointer at, uint8_t value, size_t size);
+    PatchTransaction& MemCpy(MemoryPointer at, const void* src, size_t size);
+
+    PatchTransaction& MakeNop(MemoryPointer at, size_t count = 1) { return Fill(at, 0x90, count); }
+
+    // Jump Near. Out of rel32 range the branch goes through a jump thunk near |at|, if none can be placed there the
+    // transaction fails: nothing is queued and Commit returns false until Discard.
+    PatchTransaction& MakeJmp(MemoryPointer at, MemoryPointer dest) { return MakeBranch(0xE9, at, dest); }
+    PatchTransaction& MakeCall(MemoryPointer at, MemoryPointer dest) { return MakeBranch(0xE8, at, dest); }
+
+    // Writes every patch (and its rollback) with LiveWrite, for code other threads may be running. Patches are
+    // applied in the order they were queued, so queue the one that redirects execution first. Pass |parkThreads| when
+    // a patch spans more than one instruction.
+    PatchTransaction& Live(bool enable = true, bool parkThreads = false)
+    {
+        m_live = enable;
+        m_parkThreads = parkThreads;
+        return *this;
+    }
+
+    // Applies the queued patches, later ones win where they overlap. Patches that wouldn't change anything are
+    // dropped first, so their pages aren't touched. Either everything is written or, if a page can't be unprotected,
+    // nothing is and the patches stay queued. In live mode a patch that can't be written safely stops the commit,
+    // the ones before it stay applied (and can be rolled back).
+    bool Commit();
+
+    // Restores the original bytes of everything committed so far and drops the queued patches
+    bool Rollback();
+
+    // Forgets the queued patches, committed ones stay in place
+    void Discard();
+
+    // Number of queued patches
+    size_t Size() const { return m_pending.size(); }
+
+private:
+    struct Patch
+    {
+        uintptr_t address;
+        size_t size;
+        size_t offset;  // Into the data buffer of the list the patch is in
+    };
+
+    PatchTransaction& MakeBranch(uint8_t opcode, MemoryPointer at, MemoryPointer dest);
+
+    uint8_t* Queue(uintptr_t address, size_t size);
+
+    // Writes |patches| with each page unprotected once. If |undo| is given, the bytes they replace are appended to it.
+    bool Apply(const std::vector<Patch>& patches, const std::vector<uint8_t>& data, std::vector<Patch>* undo,
+        std::vector<uint8_t>* undoData);
+
+    std::vector<Patch> m_pending;
+    std::vector<uint8_t> m_pendingData;
+
+    // Original bytes, in the order they were overwritten
+    std::vector<Patch> m_undo;
+    std::vector<uint8_t> m_undoData;
+
+    bool m_live;
+    bool m_parkThreads;
+
+    // A patch couldn't be queued
+    bool m_failed;
+};
+
+}  // namespace hook
@@ -7,10 +7,16 @@
 // https://opensource.org/licenses/MIT)
 
 #include "client/hook/Pattern.hpp"
-
-#include <windows.h>
+#include "client/hook/ExecutableMeta.hpp"
+#include "client/hook/PatternCache.hpp"
+#include "client/hook/PatternLiteral.hpp"
+#include "client/hook/PatternScanner.hpp"
+#include "client/hook/WorkerPool.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
 #include <string_view>
 #include "base/Macros.hpp"
 
@@ -19,16 +25,33 @@ namespace hook
 
 ptrdiff_t baseAddressDifference;
 
+// Smallest amount of code a worker gets in a parallel scan
+static const uintptr_t kParallelChunkSize = 1024 * 1024;
+
+// Distance from the hint covered by the first step of a hinted scan, doubled with every step after it
+static const uintptr_t kHintWindowSize = 0x1000;
+
 // sets the base to the process main base
 void SetBase()
 {
-    SetBase(reinterpret_cast<uintptr_t>(GetModuleHandle(nullptr)));
+    SetBase(ExecutableMeta::GetMainModule());
 }
 
-static void TransformPattern(std::string_view pattern, std::string& data, std::string& mask)
+// Bytes are two hex digits, either of which may be a '?' to leave that nibble open ("4?", "?5"). A '?' on its own,
+// and each of "??", is a whole wildcard byte. "?5" is only a nibble where a byte starts (at the start of the pattern,
+// after a space or after a capture or result marker), so "??AB" is still two wildcards followed by AB. A byte may be
+// followed by "&" and an explicit mask in hex ("C0&F8" matches mod == 3, reg == 0). A lone hex digit is an error.
+// Stored bytes are already masked, a position matches when (byte & mask) == value.
+static void TransformPattern(std::string_view pattern, std::string& data, std::string& mask,
+    std::vector<Pattern::Capture>& captures, size_t& resultOffset)
 {
-    uint8_t tempDigit = 0;
-    bool tempFlag = false;
+    // Capture being parsed, captures don't nest
+    bool inCapture = false;
+
+    auto isHex = [](char ch)
+    {
+        return (ch >= '0' && ch <= '9') || (ch >= 'A' && ch <= 'F') || (ch >= 'a' && ch <= 'f');
+    };
 
     auto tol = [](char ch) -> uint8_t
     {
@@ -39,92 +62,172 @@ static void TransformPattern(std::string_view pattern, std::string& data, std::s
         return uint8_t(ch - '0');
     };
 
-    for (auto ch : pattern)
+    auto closeCapture = [&]()
+    {
+        inCapture = false;
+        captures.back().size = static_cast<uint32_t>(mask.size()) - captures.back().offset;
+
+        if (captures.back().size == 0)
+        {
+            captures.pop_back();
+        }
+    };
+
+    for (size_t i = 0; i < pattern.size(); i++)
     {
-        if (ch == ' ')
+        const char ch = pattern[i];
+        const char next = i + 1 < pattern.size() ? pattern[i + 1] : '\0';
+        const bool byteStart = pattern_literal::IsByteStart(pattern.data(), pattern.data() + i);
+
+        if ((ch == '[' || ch == '<') && !inCapture)
+        {
+            inCapture = true;
+            captures.push_back({static_cast<uint32_t>(mask.size()), 0, ch == '<'});
+        }
+        else if ((ch == ']' || ch == '>') && inCapture)
         {
-            continue;
+            closeCapture();
         }
-        else if (ch == '?')
+        else if (ch == '$')
+        {
+            resultOffset = mask.size();
+        }
+        else if (ch == '?' && (!isHex(next) || !byteStart))
         {
             data.push_back(0);
-            mask.push_back('?');
+            mask.push_back(0);
         }
-        else if ((ch >= '0' && ch <= '9') || (ch >= 'A' && ch <= 'F') || (ch >= 'a' && ch <= 'f'))
+        else if ((isHex(ch) || ch == '?') && (isHex(next) || next == '?'))
         {
-            uint8_t thisDigit = tol(ch);
+            uint8_t value = static_cast<uint8_t>((ch == '?' ? 0 : tol(ch) << 4) | (next == '?' ? 0 : tol(next)));
+            uint8_t valueMask = static_cast<uint8_t>((ch == '?' ? 0x00 : 0xF0) | (next == '?' ? 0x00 : 0x0F));
+
+            i++;
 
-            if (!tempFlag)
+            if (i + 3 < pattern.size() && pattern[i + 1] == '&' && isHex(pattern[i + 2]) && isHex(pattern[i + 3]))
             {
-                tempDigit = thisDigit << 4;
-                tempFlag = true;
+                valueMask &= static_cast<uint8_t>((tol(pattern[i + 2]) << 4) | tol(pattern[i + 3]));
+                i += 3;
             }
-            else
-            {
-                tempDigit |= thisDigit;
-                tempFlag = false;
 
-                data.push_back(tempDigit);
-                mask.push_back('x');
-            }
+            data.push_back(static_cast<char>(value & valueMask));
+            mask.push_back(static_cast<char>(valueMask));
+        }
+        else if (isHex(ch))
+        {
+            // Dropping it would shift every byte after it
+            assert(false && "Lone hex digit in pattern");
         }
     }
-}
 
-class ExecutableMeta
-{
-public:
-    template <typename TReturn, typename TOffset>
-    TReturn* GetRVA(TOffset rva)
+    // An unterminated capture runs to the end
+    if (inCapture)
     {
-        return (TReturn*)(m_begin + rva);
+        closeCapture();
     }
+}
 
-    explicit ExecutableMeta(void* module) :
-        m_begin((uintptr_t)module)
-    {
-        PIMAGE_DOS_HEADER dosHeader = GetRVA<IMAGE_DOS_HEADER>(0);
-        PIMAGE_NT_HEADERS ntHeader = GetRVA<IMAGE_NT_HEADERS>(dosHeader->e_lfanew);
+void Pattern::Initialize(const char* pattern, size_t length)
+{
+    // Transform the base pattern from IDA format to canonical format
+    TransformPattern(std::string_view(pattern, length), m_bytes, m_mask, m_captures, m_resultOffset);
+}
 
-        m_end = m_begin + ntHeader->OptionalHeader.SizeOfCode;
-    }
+intptr_t Pattern::ReadCapture(size_t capture, size_t index) const
+{
+    assert(capture < m_captures.size() && index < m_matches.size());
 
-    ExecutableMeta(uintptr_t begin, uintptr_t end) :
-        m_begin(begin),
-        m_end(end)
-    {}
+    const Capture& operand = m_captures[capture];
+    const uint8_t* bytes = m_matches[index].Get<uint8_t>(operand.offset);
 
-    inline uintptr_t begin() const
+    int64_t value = 0;
+
+    switch (operand.size)
     {
-        return m_begin;
+        case 1:
+            value = static_cast<int8_t>(bytes[0]);
+            break;
+        case 2:
+        {
+            int16_t operandValue;
+            memcpy(&operandValue, bytes, sizeof(operandValue));
+            value = operandValue;
+            break;
+        }
+        case 4:
+        {
+            int32_t operandValue;
+            memcpy(&operandValue, bytes, sizeof(operandValue));
+            value = operandValue;
+            break;
+        }
+        default:
+        {
+            // Sign extended from the top captured bit like the sizes above, past 8 bytes only the first 8 count
+            const size_t size = std::min<size_t>(operand.size, sizeof(value));
+            uint64_t operandValue = 0;
+            memcpy(&operandValue, bytes, size);
+
+            if (size < sizeof(operandValue))
+            {
+                const uint64_t sign = 1ull << (size * 8 - 1);
+                operandValue = (operandValue ^ sign) - sign;
+            }
+
+            value = static_cast<int64_t>(operandValue);
+            break;
+        }
     }
 
-    inline uintptr_t end() const
+    if (operand.relative)
     {
-        return m_end;
+        return reinterpret_cast<intptr_t>(bytes + operand.size) + static_cast<intptr_t>(value);
     }
 
-private:
-    uintptr_t m_begin;
-    uintptr_t m_end;
-};
+    return static_cast<intptr_t>(value);
+}
 
-void Pattern::Initialize(const char* pattern, size_t length)
+ExecutableMeta Pattern::GetExecutable() const
 {
-    // Transform the base pattern from IDA format to canonical format
-    TransformPattern(std::string_view(pattern, length), m_bytes, m_mask);
+    return m_rangeStart != 0 && m_rangeEnd != 0 ? ExecutableMeta(m_rangeStart, m_rangeEnd) : ExecutableMeta(m_module);
 }
 
 void Pattern::EnsureMatches(uint32_t maxCount)
 {
     if (m_matched)
     {
+        // Keep the first |maxCount| like a scan of its own would have, matches are in address order
+        if (m_batched && m_matches.size() > maxCount)
+        {
+            m_matches.erase(m_matches.begin() + maxCount, m_matches.end());
+        }
+
         return;
     }
 
     // Scan the executable for code
-    ExecutableMeta executable =
-        m_rangeStart != 0 && m_rangeEnd != 0 ? ExecutableMeta(m_rangeStart, m_rangeEnd) : ExecutableMeta(m_module);
+    ExecutableMeta executable = GetExecutable();
+
+    // Without an expected count every match is needed, and the hint wouldn't save anything
+    const bool hinted = m_hasHint && maxCount != UINT32_MAX;
+    const uintptr_t hint = m_hintIsRVA ? executable.base() + m_hint : m_hint;
+
+    // Only whole modules have an identity to key the cache on
+    PatternCache* cache = PatternCache::Get();
+    uint64_t cacheKey = 0;
+
+    if (cache && executable.identity() != 0)
+    {
+        // A hinted scan keeps the matches nearest the hint instead of the first ones, so it's cached apart
+        uint64_t hintRVA = hint - executable.base();
+        cacheKey = PatternCache::MakeKey(executable.identity(), m_bytes, m_mask, maxCount, hinted ? &hintRVA : nullptr);
+
+        if (LoadCachedMatches(*cache, cacheKey, executable))
+        {
+            m_matched = true;
+            return;
+        }
+    }
 
     auto matchSuccess = [&](uintptr_t address)
     {
@@ -133,49 +236,290 @@ void Pattern::EnsureMatches(uint32_t maxCount)
         return (m_matches.size() == maxCount);
     };
 
-    const uint8_t* pattern = reinterpret_cast<const uint8_t*>(m_bytes.c_str());
-    const char* mask = m_mask.c_str();
-    size_t maskSize = m_mask.size();
-    size_t lastWild = m_mask.find_last_of('?');
+    PatternScanner scanner(reinterpret_cast<const uint8_t*>(m_bytes.c_str()),
+        reinterpret_cast<const uint8_t*>(m_mask.c_str()), m_mask.size());
+
+    if (hinted)
+    {
+        EnsureMatchesNear(scanner, maxCount, executable, hint);
+    }
+    else
+    {
+        for (size_t i = 0; i < executable.rangeCount() && m_matches.size() != maxCount; i++)
+        {
+            const ExecutableMeta::Range& range = executable.ranges()[i];
+
+            if (m_parallel && range.end - range.begin > 2 * kParallelChunkSize)
+            {
+                EnsureMatchesParallel(scanner, maxCount, range.begin, range.end);
+                continue;
+            }
+
+            const uint8_t* end = reinterpret_cast<const uint8_t*>(range.end);
+
+            for (const uint8_t* ptr = reinterpret_cast<const uint8_t*>(range.begin);
+                 (ptr = scanner.FindNext(ptr, end)) != nullptr; ptr++)
+            {
+                m_matches.emplace_back(const_cast<uint8_t*>(ptr));
 
-    ptrdiff_t Last[256];
+                if (matchSuccess(reinterpret_cast<uintptr_t>(ptr)))
+                {
+                    break;
+                }
+            }
+        }
+    }
+
+    if (cacheKey != 0)
+    {
+        StoreCachedMatches(*cache, cacheKey, executable);
+    }
+
+    m_matched = true;
+}
+
+void Pattern::EnsureMatchesNear(const PatternScanner& scanner, uint32_t maxCount, const ExecutableMeta& executable,
+    uintptr_t hint)
+{
+    const uintptr_t lowest = executable.begin();
+    const uintptr_t highest = executable.end();
+
+    hint = std::min(std::max(hint, lowest), highest);
 
-    std::fill(std::begin(Last), std::end(Last), lastWild == std::string::npos ? -1 : static_cast<ptrdiff_t>(lastWild));
+    std::vector<uintptr_t> found;
 
-    for (ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(maskSize); ++i)
+    // Matches starting in [begin, end), they may run past |end|
+    auto scanBand = [&](uintptr_t begin, uintptr_t end)
     {
-        if (Last[pattern[i]] < i)
+        for (size_t i = 0; i < executable.rangeCount(); i++)
         {
-            Last[pattern[i]] = i;
+            const ExecutableMeta::Range& range = executable.ranges()[i];
+            const uintptr_t bandBegin = std::max(begin, range.begin);
+            const uintptr_t bandEnd = std::min(end, range.end);
+
+            if (bandBegin >= bandEnd)
+            {
+                continue;
+            }
+
+            const uint8_t* scanEnd =
+                reinterpret_cast<const uint8_t*>(std::min(range.end, bandEnd + scanner.Size() - 1));
+
+            for (const uint8_t* ptr = reinterpret_cast<const uint8_t*>(bandBegin);
+                 (ptr = scanner.FindNext(ptr, scanEnd)) != nullptr && reinterpret_cast<uintptr_t>(ptr) < bandEnd; ptr++)
+            {
+                found.push_back(reinterpret_cast<uintptr_t>(ptr));
+            }
         }
+    };
+
+    // Everything within |window| of the hint has been scanned after each step, so once there are enough matches, the
+    // nearest of them are nearer than anything not scanned yet
+    uintptr_t low = hint;
+    uintptr_t high = hint;
+
+    for (uintptr_t window = kHintWindowSize; found.size() < maxCount && (low != lowest || high != highest); window *= 2)
+    {
+        const uintptr_t nextLow = hint - std::min(window, hint - lowest);
+        const uintptr_t nextHigh = hint + std::min(window, highest - hint);
+
+        scanBand(nextLow, low);
+        scanBand(high, nextHigh);
+
+        low = nextLow;
+        high = nextHigh;
+    }
+
+    auto distance = [hint](uintptr_t address) { return address > hint ? address - hint : hint - address; };
+
+    std::sort(found.begin(), found.end(), [&](uintptr_t a, uintptr_t b) { return distance(a) < distance(b); });
+    found.resize(std::min<size_t>(found.size(), maxCount));
+    std::sort(found.begin(), found.end());
+
+    for (uintptr_t address : found)
+    {
+        m_matches.emplace_back(reinterpret_cast<void*>(address));
     }
+}
 
-    for (uintptr_t i = executable.begin(), end = executable.end() - maskSize; i <= end;)
+void Pattern::EnsureMatchesParallel(const PatternScanner& scanner, uint32_t maxCount, uintptr_t begin, uintptr_t end)
+{
+    struct Chunk
     {
-        uint8_t* ptr = reinterpret_cast<uint8_t*>(i);
-        ptrdiff_t j = maskSize - 1;
+        std::vector<PatternMatch> matches;
+        bool done = false;
+    };
+
+    // Earlier ranges may already have found some of them
+    const size_t wanted = maxCount - m_matches.size();
+
+    WorkerPool& pool = WorkerPool::Get();
 
-        while ((j >= 0) && (mask[j] == '?' || pattern[j] == ptr[j]))
-            j--;
+    const uintptr_t chunkSize = std::max<uintptr_t>(kParallelChunkSize, (end - begin) / (pool.Concurrency() * 8));
+    const size_t chunkCount = static_cast<size_t>((end - begin + chunkSize - 1) / chunkSize);
 
-        if (j < 0)
+    std::vector<Chunk> chunks(chunkCount);
+    std::mutex chunksMutex;
+
+    // Chunks past this index can't contribute to the first |wanted| matches anymore
+    std::atomic<size_t> cutoff(chunkCount);
+
+    pool.ParallelFor(chunkCount, [&](size_t index)
+    {
+        if (index > cutoff.load(std::memory_order_relaxed))
         {
-            m_matches.emplace_back(ptr);
+            return;
+        }
+
+        Chunk& chunk = chunks[index];
+
+        // Matches have to start inside the chunk, but may run into the next one
+        const uintptr_t chunkStart = begin + index * chunkSize;
+        const uintptr_t chunkEnd = std::min(end, chunkStart + chunkSize);
+        const uint8_t* scanEnd = reinterpret_cast<const uint8_t*>(std::min(end, chunkEnd + scanner.Size() - 1));
 
-            if (matchSuccess(i))
+        for (const uint8_t* ptr = reinterpret_cast<const uint8_t*>(chunkStart);
+             (ptr = scanner.FindNext(ptr, scanEnd)) != nullptr && reinterpret_cast<uintptr_t>(ptr) < chunkEnd; ptr++)
+        {
+            chunk.matches.emplace_back(const_cast<uint8_t*>(ptr));
+
+            if (chunk.matches.size() >= wanted || index > cutoff.load(std::memory_order_relaxed))
             {
                 break;
             }
-            i++;
         }
-        else
+
+        std::lock_guard<std::mutex> lock(chunksMutex);
+        chunk.done = true;
+
+        // Once a run of finished chunks from the start holds enough matches, everything after it can stop
+        size_t total = 0;
+
+        for (size_t i = 0; i < chunkCount && chunks[i].done; i++)
+        {
+            total += chunks[i].matches.size();
+
+            if (total >= wanted)
+            {
+                cutoff.store(std::min(cutoff.load(std::memory_order_relaxed), i), std::memory_order_relaxed);
+                break;
+            }
+        }
+    });
+
+    // Merge in address order
+    for (const Chunk& chunk : chunks)
+    {
+        for (const PatternMatch& match : chunk.matches)
         {
-            // TODO: Replace w/ custom impl
-            i += std::max(1, j - Last[ptr[j]]);
+            if (m_matches.size() == maxCount)
+            {
+                return;
+            }
+
+            m_matches.push_back(match);
         }
     }
+}
 
-    m_matched = true;
+Pattern::MatchRange::MatchRange(const Pattern& pattern) :
+    m_bytes(pattern.m_bytes),
+    m_mask(pattern.m_mask),
+    m_resultOffset(pattern.m_resultOffset),
+    m_executable(pattern.GetExecutable()),
+    m_scanner(reinterpret_cast<const uint8_t*>(m_bytes.c_str()), reinterpret_cast<const uint8_t*>(m_mask.c_str()),
+        m_mask.size())
+{
+}
+
+Pattern::MatchIterator Pattern::MatchRange::begin() const
+{
+    MatchIterator it;
+    it.m_owner = this;
+
+    if (m_executable.rangeCount() != 0)
+    {
+        Seek(it, reinterpret_cast<const uint8_t*>(m_executable.ranges()[0].begin));
+    }
+
+    return it;
+}
+
+void Pattern::MatchRange::Seek(MatchIterator& it, const uint8_t* from) const
+{
+    for (; it.m_rangeIndex < m_executable.rangeCount(); it.m_rangeIndex++)
+    {
+        const ExecutableMeta::Range& range = m_executable.ranges()[it.m_rangeIndex];
+        const uint8_t* begin = std::max(from, reinterpret_cast<const uint8_t*>(range.begin));
+
+        if (const uint8_t* match = m_scanner.FindNext(begin, reinterpret_cast<const uint8_t*>(range.end)))
+        {
+            it.m_match = PatternMatch(const_cast<uint8_t*>(match + m_resultOffset));
+            return;
+        }
+    }
+
+    it = MatchIterator();
+}
+
+Pattern::MatchIterator& Pattern::MatchIterator::operator++()
+{
+    if (m_owner)
+    {
+        m_owner->Seek(*this, m_match.Get<uint8_t>(1 - static_cast<ptrdiff_t>(m_owner->m_resultOffset)));
+    }
+
+    return *this;
+}
+
+bool Pattern::LoadCachedMatches(PatternCache& cache, uint64_t key, const ExecutableMeta& executable)
+{
+    uint32_t rvas[PatternCache::kMaxMatches];
+    uint32_t count;
+
+    if (!cache.Lookup(key, rvas, count))
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const uintptr_t address = executable.base() + rvas[i];
+        const ExecutableMeta::Range* range = executable.ranges();
+        const ExecutableMeta::Range* lastRange = range + executable.rangeCount();
+
+        while (range != lastRange && !(address >= range->begin && address + m_mask.size() <= range->end))
+        {
+            range++;
+        }
+
+        if (range == lastRange || !ConsiderMatch(address))
+        {
+            m_matches.clear();
+            cache.Invalidate(key);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Pattern::StoreCachedMatches(PatternCache& cache, uint64_t key, const ExecutableMeta& executable)
+{
+    // Nothing to verify a cached miss against, so only hits are worth keeping
+    if (m_matches.empty() || m_matches.size() > PatternCache::kMaxMatches)
+    {
+        return;
+    }
+
+    uint32_t rvas[PatternCache::kMaxMatches];
+
+    for (size_t i = 0; i < m_matches.size(); i++)
+    {
+        rvas[i] = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(m_matches[i].Get<void>()) - executable.base());
+    }
+
+    cache.Store(key, rvas, static_cast<uint32_t>(m_matches.size()));
 }
 
 bool Pattern::ConsiderMatch(uintptr_t offset)
@@ -187,12 +531,7 @@ bool Pattern::ConsiderMatch(uintptr_t offset)
 
     for (size_t i = 0, j = m_mask.size(); i < j; i++)
     {
-        if (mask[i] == '?')
-        {
-            continue;
-        }
-
-        if (pattern[i] != ptr[i])
+        if ((ptr[i] & mask[i]) != pattern[i])
         {
             return false;
         }
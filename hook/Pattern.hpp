@@ -12,20 +12,29 @@
 #include <stdint.h>
 
 #include <cassert>
+#include <iterator>
+#include <string>
 #include <vector>
 
 #include "build/BuildConfig.hpp"
+#include "client/hook/ExecutableMeta.hpp"
+#include "client/hook/PatternScanner.hpp"
 
 namespace hook
 {
 
+class PatternCache;
+
 // TODO: Integrate with MemoryPointer
 extern ptrdiff_t baseAddressDifference;
 
 // Sets the base address difference based on an obtained pointer
 inline void SetBase(uintptr_t address)
 {
-#ifdef ARCH_CPU_X86
+#if defined(OS_POSIX)
+    // ELF executables are mostly position-independent, so RVAs are relative to the load address itself
+    uintptr_t addressDiff = address;
+#elif defined(ARCH_CPU_X86)
     uintptr_t addressDiff = (address - 0x400000);
 #elif defined(ARCH_CPU_X86_64)
     uintptr_t addressDiff = (address - 0x140000000);
@@ -42,7 +51,9 @@ template <typename T>
 inline T* GetRVA(uintptr_t rva)
 {
     SetBase();
-#ifdef ARCH_CPU_X86
+#if defined(OS_POSIX)
+    return (T*)(baseAddressDifference + rva);
+#elif defined(ARCH_CPU_X86)
     return (T*)(baseAddressDifference + 0x400000 + rva);
 #elif defined(ARCH_CPU_X86_64)
     return (T*)(0x140000000 + rva);
@@ -70,6 +81,83 @@ private:
 class Pattern
 {
 public:
+    // Operand marked with [..] or <..>, see GetValue
+    struct Capture
+    {
+        uint32_t offset;
+        uint32_t size;
+        bool relative;
+    };
+
+    class MatchRange;
+
+    class MatchIterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = PatternMatch;
+        using difference_type = ptrdiff_t;
+        using pointer = const PatternMatch*;
+        using reference = const PatternMatch&;
+
+        // The end iterator
+        MatchIterator() :
+            m_owner(nullptr), m_rangeIndex(0), m_match(nullptr)
+        {}
+
+        reference operator*() const { return m_match; }
+        pointer operator->() const { return &m_match; }
+
+        MatchIterator& operator++();
+
+        MatchIterator operator++(int)
+        {
+            MatchIterator previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        bool operator==(const MatchIterator& other) const { return m_match.Get<void>() == other.m_match.Get<void>(); }
+        bool operator!=(const MatchIterator& other) const { return !(*this == other); }
+
+    private:
+        friend class MatchRange;
+
+        const MatchRange* m_owner;
+        size_t m_rangeIndex;
+        PatternMatch m_match;
+    };
+
+    // Matches in address order, found as the iteration goes: every increment resumes the scan right after the
+    // current match, so breaking out early skips the rest of the module. Holds its own copy of the pattern and
+    // allocates nothing per match. Neither the cache nor Parallel() apply, and the pattern's own matches are left
+    // alone.
+    class MatchRange
+    {
+    public:
+        MatchRange(const MatchRange&) = delete;
+        MatchRange& operator=(const MatchRange&) = delete;
+
+        MatchIterator begin() const;
+        MatchIterator end() const { return MatchIterator(); }
+
+    private:
+        friend class Pattern;
+        friend class MatchIterator;
+
+        explicit MatchRange(const Pattern& pattern);
+
+        // Moves |it| to the first match at or after |from|, which lies in code range |it.m_rangeIndex|
+        void Seek(MatchIterator& it, const uint8_t* from) const;
+
+        std::string m_bytes;
+        std::string m_mask;
+        size_t m_resultOffset;
+
+        ExecutableMeta m_executable;
+        PatternScanner m_scanner;
+    };
+
     template <size_t Len>
     Pattern(const char(&pattern)[Len]) :
         Pattern(GetRVA<void>(0))
@@ -90,10 +178,38 @@ public:
         return *this;
     }
 
+    // Scans outward from |address| in growing windows instead of from the start, and stops once the expected number
+    // of matches (Count, CountHint, GetOne) is found, keeping the nearest ones. Only pays off when that number is
+    // given, otherwise every match is needed anyway.
+    Pattern& Hint(const void* address)
+    {
+        m_hint = reinterpret_cast<uintptr_t>(address);
+        m_hintIsRVA = false;
+        m_hasHint = true;
+        return *this;
+    }
+
+    // Same, with the hint relative to the module base, e.g. where the match was in the previous build
+    Pattern& HintRVA(uintptr_t rva)
+    {
+        m_hint = rva;
+        m_hintIsRVA = true;
+        m_hasHint = true;
+        return *this;
+    }
+
+    // Splits the scan in chunks that run on the shared worker pool, worth it for large modules
+    Pattern& Parallel(bool enable = true)
+    {
+        m_parallel = enable;
+        return *this;
+    }
+
     Pattern& Clear()
     {
         m_matches.clear();
         m_matched = false;
+        m_batched = false;
         return *this;
     }
 
@@ -119,26 +235,95 @@ public:
         return GetOne().Get<T>(offset);
     }
 
+    // Operand |capture| of match |index|, captures being numbered in the order they appear in the pattern:
+    //   [? ? ? ?]  the bytes inside as a little endian integer, sign extended from their size
+    //   <? ? ? ?>  the address they point at when read as a displacement from the end of the captured bytes, which is
+    //              the end of the instruction for call, jmp, jcc and most [rip + disp32] operands
+    // A '$' moves the result of Get/GetFirst from the start of the pattern to where it appears.
+    //
+    // Usage:
+    //   auto process = Pattern("E8 <? ? ? ?> 84 C0 74 12").Count(1).GetAddress<void>(0);
+    //   auto offset = Pattern("8B 8E [? ? ? ?] $ 85 C9").Count(1).GetValue<uint32_t>(0);
+    template <typename T = intptr_t>
+    T GetValue(size_t capture, size_t index = 0)
+    {
+        EnsureMatches(UINT32_MAX);
+        return static_cast<T>(ReadCapture(capture, index));
+    }
+
+    template <typename T = void>
+    T* GetAddress(size_t capture, size_t index = 0)
+    {
+        EnsureMatches(UINT32_MAX);
+        return reinterpret_cast<T*>(ReadCapture(capture, index));
+    }
+
+    size_t CaptureCount() const { return m_captures.size(); }
+
+    // Usage:
+    //   for (const PatternMatch& match : Pattern("E8 ? ? ? ? 84 C0").Matches())
+    //       if (IsWanted(match)) { Use(match); break; }
+    MatchRange Matches() const { return MatchRange(*this); }
+
 protected:
-    Pattern(void* module) : m_module(module), m_rangeEnd(0), m_matched(false) {}
+    Pattern(void* module) :
+        m_resultOffset(0), m_matched(false), m_parallel(false), m_batched(false), m_hasHint(false), m_hintIsRVA(false),
+        m_hint(0), m_rangeStart(0), m_rangeEnd(0)
+    {
+        m_module = module;
+    }
 
-    Pattern(uintptr_t begin, uintptr_t end) : m_rangeStart(begin), m_rangeEnd(end), m_matched(false) {}
+    Pattern(uintptr_t begin, uintptr_t end) :
+        m_resultOffset(0), m_matched(false), m_parallel(false), m_batched(false), m_hasHint(false), m_hintIsRVA(false),
+        m_hint(0), m_rangeStart(begin), m_rangeEnd(end)
+    {}
 
     void Initialize(const char* pattern, size_t length);
 
 private:
+    // Code ranges to scan
+    ExecutableMeta GetExecutable() const;
+
+    friend class PatternBatch;
+
     bool ConsiderMatch(uintptr_t offset);
 
     void EnsureMatches(uint32_t maxCount);
 
-    PatternMatch GetInternal(size_t index) const { return m_matches[index]; }
+    void EnsureMatchesParallel(const PatternScanner& scanner, uint32_t maxCount, uintptr_t begin, uintptr_t end);
+
+    // Takes the |maxCount| matches nearest to |hint|
+    void EnsureMatchesNear(const PatternScanner& scanner, uint32_t maxCount, const ExecutableMeta& executable,
+        uintptr_t hint);
 
+    // Re-verifies cached matches in place, drops the record if any of them doesn't match anymore
+    bool LoadCachedMatches(PatternCache& cache, uint64_t key, const ExecutableMeta& executable);
+
+    void StoreCachedMatches(PatternCache& cache, uint64_t key, const ExecutableMeta& executable);
+
+    PatternMatch GetInternal(size_t index) const { return m_matches[index].Get<void>(m_resultOffset); }
+
+    intptr_t ReadCapture(size_t capture, size_t index) const;
+
+    // A byte matches when (byte & m_mask[i]) == m_bytes[i], a wildcard has a zero mask
     std::string m_bytes;
     std::string m_mask;
 
+    // Matches are kept at the start of the pattern, the result offset only applies when they're handed out
+    std::vector<Capture> m_captures;
+    size_t m_resultOffset;
+
     std::vector<PatternMatch> m_matches;
 
     bool m_matched;
+    bool m_parallel;
+
+    // Matched by a PatternBatch, which may have found more than a later Count/CountHint asks for
+    bool m_batched;
+
+    bool m_hasHint;
+    bool m_hintIsRVA;
+    uintptr_t m_hint;
 
     union
     {
@@ -0,0 +1,393 @@
+// Multi-pattern matching utilities
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#include "client/hook/PatternBatch.hpp"
+
+#include <algorithm>
+#include <climits>
+
+#include "client/hook/ExecutableMeta.hpp"
+#include "client/hook/PatternScanner.hpp"
+
+namespace hook
+{
+
+namespace
+{
+
+// Anchored bytes may leave this many values open (four mask bits), each value takes a key of its own
+const size_t kMaxAnchorValues = 16;
+
+// Fewer patterns than this are scanned one after another
+const size_t kMinBatchSize = 4;
+
+// A fixed byte (or pair of adjacent fixed bytes) of a pattern, at |offset| from its start. A partly masked byte has an
+// anchor for every value it matches.
+struct Anchor
+{
+    uint16_t key;
+    uint32_t entry;
+    uint32_t offset;
+
+    bool operator<(const Anchor& rhs) const { return key < rhs.key; }
+};
+
+// Anchors sorted by key, with the index of the first one of every key
+struct AnchorIndex
+{
+    std::vector<Anchor> anchors;
+    std::vector<uint32_t> first;
+
+    void Build(size_t keyCount)
+    {
+        std::sort(anchors.begin(), anchors.end());
+        first.resize(keyCount + 1);
+
+        for (size_t key = 0, i = 0; key <= keyCount; key++)
+        {
+            while (i < anchors.size() && anchors[i].key < key)
+            {
+                i++;
+            }
+
+            first[key] = static_cast<uint32_t>(i);
+        }
+    }
+};
+
+// Positions taken from the PairFilter at once
+const size_t kPositionBufferSize = 256;
+
+// Pairs are counted over this many blocks spread over the code, if there's enough of it for that to be a sample
+const size_t kSampleBlocks = 64;
+const size_t kSampleBlockSize = 4096;
+
+bool MatchesAt(const std::string& bytes, const std::string& mask, const uint8_t* ptr)
+{
+    for (size_t i = 0, j = mask.size(); i < j; i++)
+    {
+        if ((ptr[i] & static_cast<uint8_t>(mask[i])) != static_cast<uint8_t>(bytes[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Byte values that match |value| under |mask|
+size_t GetMatchingValues(uint8_t value, uint8_t mask, uint8_t (&values)[256])
+{
+    size_t count = 0;
+
+    for (unsigned other = 0; other < 256; other++)
+    {
+        if ((other & mask) == value)
+        {
+            values[count++] = static_cast<uint8_t>(other);
+        }
+    }
+
+    return count;
+}
+
+// Counts the pairs of adjacent bytes in a sample of the code, the static byte frequencies can't tell which pairs are
+// rare in it. Empty if the code is small enough to not need anchors that good.
+std::vector<uint32_t> SamplePairs(const ExecutableMeta& executable)
+{
+    std::vector<uint32_t> counts;
+    size_t total = 0;
+
+    for (size_t i = 0; i < executable.rangeCount(); i++)
+    {
+        total += executable.ranges()[i].end - executable.ranges()[i].begin;
+    }
+
+    if (total < 4 * kSampleBlocks * kSampleBlockSize)
+    {
+        return counts;
+    }
+
+    counts.resize(0x10000);
+    const size_t stride = total / kSampleBlocks;
+
+    for (size_t i = 0; i < executable.rangeCount(); i++)
+    {
+        const ExecutableMeta::Range& range = executable.ranges()[i];
+
+        for (uintptr_t block = range.begin; range.end - block > kSampleBlockSize; block += stride)
+        {
+            const uint8_t* ptr = reinterpret_cast<const uint8_t*>(block);
+
+            for (size_t j = 0; j < kSampleBlockSize; j++)
+            {
+                counts[ptr[j] | (ptr[j + 1] << 8)]++;
+            }
+        }
+    }
+
+    return counts;
+}
+
+size_t CountMatchingValues(uint8_t mask)
+{
+    size_t count = 1;
+
+    for (uint8_t bit = 1; bit != 0; bit <<= 1)
+    {
+        count *= (mask & bit) ? 1 : 2;
+    }
+
+    return count;
+}
+
+}  // namespace
+
+PatternBatch::PatternBatch() :
+    PatternBatch(GetRVA<void>(0))
+{
+}
+
+PatternBatch::PatternBatch(void* module) :
+    m_isRange(false),
+    m_module(module),
+    m_rangeStart(0),
+    m_rangeEnd(0)
+{
+}
+
+PatternBatch::PatternBatch(uintptr_t begin, uintptr_t end) :
+    m_isRange(true),
+    m_module(nullptr),
+    m_rangeStart(begin),
+    m_rangeEnd(end)
+{
+}
+
+std::unique_ptr<Pattern> PatternBatch::MakePattern() const
+{
+    return std::unique_ptr<Pattern>(m_isRange ? new Pattern(m_rangeStart, m_rangeEnd) : new Pattern(m_module));
+}
+
+Pattern& PatternBatch::Add(std::string_view pattern, uint32_t maxCount)
+{
+    std::unique_ptr<Pattern> entry = MakePattern();
+    entry->Initialize(pattern.data(), pattern.size());
+
+    m_entries.push_back({std::move(entry), maxCount});
+    return *m_entries.back().pattern;
+}
+
+void PatternBatch::Scan()
+{
+    AnchorIndex pairAnchors;
+    AnchorIndex byteAnchors;
+    std::vector<size_t> anchored;
+    PairFilter filter;
+
+    ExecutableMeta executable = m_isRange ? ExecutableMeta(m_rangeStart, m_rangeEnd) : ExecutableMeta(m_module);
+    const std::vector<uint32_t> pairCounts = SamplePairs(executable);
+
+    uint8_t firstValues[256];
+    uint8_t secondValues[256];
+
+    for (size_t i = 0; i < m_entries.size(); i++)
+    {
+        Pattern& pattern = *m_entries[i].pattern;
+
+        if (pattern.m_matched)
+        {
+            continue;
+        }
+
+        pattern.m_batched = true;
+
+        const auto* bytes = reinterpret_cast<const uint8_t*>(pattern.m_bytes.data());
+        const auto* mask = reinterpret_cast<const uint8_t*>(pattern.m_mask.data());
+        const size_t size = pattern.m_mask.size();
+
+        // Prefer the rarest pair of adjacent fixed bytes, by the sample first, then the rarest single one
+        ptrdiff_t bestPair = -1;
+        ptrdiff_t bestByte = -1;
+        uint64_t bestPairScore = UINT64_MAX;
+        int bestByteScore = INT_MAX;
+
+        for (size_t j = 0; j < size; j++)
+        {
+            const size_t values = CountMatchingValues(mask[j]);
+
+            if (values > kMaxAnchorValues)
+            {
+                continue;
+            }
+
+            const int score = PatternScanner::MaskedFrequency(bytes[j], mask[j]);
+
+            if (score < bestByteScore)
+            {
+                bestByte = static_cast<ptrdiff_t>(j);
+                bestByteScore = score;
+            }
+
+            if (j + 1 >= size || values * CountMatchingValues(mask[j + 1]) > kMaxAnchorValues)
+            {
+                continue;
+            }
+
+            uint64_t pairScore = score + PatternScanner::MaskedFrequency(bytes[j + 1], mask[j + 1]);
+
+            if (!pairCounts.empty())
+            {
+                const size_t firstCount = GetMatchingValues(bytes[j], mask[j], firstValues);
+                const size_t secondCount = GetMatchingValues(bytes[j + 1], mask[j + 1], secondValues);
+                uint64_t sampled = 0;
+
+                for (size_t first = 0; first < firstCount; first++)
+                {
+                    for (size_t second = 0; second < secondCount; second++)
+                    {
+                        sampled += pairCounts[firstValues[first] | (secondValues[second] << 8)];
+                    }
+                }
+
+                // Above any sum of two static frequencies
+                pairScore += sampled << 9;
+            }
+
+            if (pairScore < bestPairScore)
+            {
+                bestPair = static_cast<ptrdiff_t>(j);
+                bestPairScore = pairScore;
+            }
+        }
+
+        if (bestPair >= 0)
+        {
+            const size_t firstCount = GetMatchingValues(bytes[bestPair], mask[bestPair], firstValues);
+            const size_t secondCount = GetMatchingValues(bytes[bestPair + 1], mask[bestPair + 1], secondValues);
+
+            for (size_t first = 0; first < firstCount; first++)
+            {
+                for (size_t second = 0; second < secondCount; second++)
+                {
+                    const uint16_t key = static_cast<uint16_t>(firstValues[first] | (secondValues[second] << 8));
+
+                    pairAnchors.anchors.push_back({key, static_cast<uint32_t>(i), static_cast<uint32_t>(bestPair)});
+                    filter.AddPair(firstValues[first], secondValues[second]);
+                }
+            }
+
+            anchored.push_back(i);
+        }
+        else if (bestByte >= 0)
+        {
+            const size_t count = GetMatchingValues(bytes[bestByte], mask[bestByte], firstValues);
+
+            for (size_t value = 0; value < count; value++)
+            {
+                byteAnchors.anchors.push_back(
+                    {firstValues[value], static_cast<uint32_t>(i), static_cast<uint32_t>(bestByte)});
+                filter.AddByte(firstValues[value]);
+            }
+
+            anchored.push_back(i);
+        }
+        else
+        {
+            // Nothing to anchor on, this one matches everywhere anyway
+            pattern.EnsureMatches(m_entries[i].maxCount);
+        }
+    }
+
+    // The single pattern kernels compare two anchors for 32 positions at once, a pass over every position only pays
+    // off once it replaces a few of them, and only if the filter is vectorized too
+    if (anchored.size() < kMinBatchSize || !PairFilter::IsVectorized())
+    {
+        for (size_t i : anchored)
+        {
+            m_entries[i].pattern->EnsureMatches(m_entries[i].maxCount);
+        }
+
+        return;
+    }
+
+    size_t remaining = anchored.size();
+
+    pairAnchors.Build(0x10000);
+    byteAnchors.Build(0x100);
+
+    const uint8_t* positions[kPositionBufferSize];
+
+    // Range being scanned, matches can't cross into the next one
+    const uint8_t* begin = nullptr;
+    const uint8_t* end = nullptr;
+
+    auto visit = [&](const AnchorIndex& index, uint16_t key, const uint8_t* ptr)
+    {
+        for (uint32_t i = index.first[key], last = index.first[key + 1]; i != last; i++)
+        {
+            const Anchor& anchor = index.anchors[i];
+            Entry& entry = m_entries[anchor.entry];
+            Pattern& pattern = *entry.pattern;
+
+            if (pattern.m_matches.size() >= entry.maxCount || ptr < begin + anchor.offset)
+            {
+                continue;
+            }
+
+            const uint8_t* start = ptr - anchor.offset;
+
+            if (static_cast<size_t>(end - start) < pattern.m_mask.size() ||
+                !MatchesAt(pattern.m_bytes, pattern.m_mask, start))
+            {
+                continue;
+            }
+
+            // A pattern has a single anchor, so its matches come in address order
+            pattern.m_matches.emplace_back(const_cast<uint8_t*>(start));
+
+            if (pattern.m_matches.size() == entry.maxCount)
+            {
+                remaining--;
+            }
+        }
+    };
+
+    for (size_t i = 0; i < executable.rangeCount() && remaining != 0; i++)
+    {
+        begin = reinterpret_cast<const uint8_t*>(executable.ranges()[i].begin);
+        end = reinterpret_cast<const uint8_t*>(executable.ranges()[i].end);
+
+        for (const uint8_t* from = begin; from < end && remaining != 0;)
+        {
+            const size_t count = filter.FindAll(from, end, positions, kPositionBufferSize);
+
+            for (size_t j = 0; j < count && remaining != 0; j++)
+            {
+                const uint8_t* ptr = positions[j];
+
+                if (ptr + 1 < end && filter.HasPair(ptr[0], ptr[1]))
+                {
+                    visit(pairAnchors, static_cast<uint16_t>(ptr[0] | (ptr[1] << 8)), ptr);
+                }
+
+                if (filter.HasByte(*ptr))
+                {
+                    visit(byteAnchors, *ptr, ptr);
+                }
+            }
+        }
+    }
+
+    for (auto& entry : m_entries)
+    {
+        entry.pattern->m_matched = true;
+    }
+}
+
+}  // namespace hook
@@ -0,0 +1,77 @@
+// Multi-pattern matching utilities
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "client/hook/Pattern.hpp"
+
+namespace hook
+{
+
+// Resolves many patterns in a single pass over the code range. Every pattern is anchored on its rarest pair of
+// adjacent fixed bytes, as counted in a sample of the code, a PairFilter over those pairs skips to the positions
+// where one of them starts, and only the anchors of a hit are verified. Below a few patterns, or without AVX2, the
+// single pattern kernels are faster, so the patterns are scanned one after another then.
+//
+// Usage:
+//   PatternBatch batch;
+//   Pattern& a = batch.Add("E8 ? ? ? ? 84 C0 74 12");
+//   Pattern& b = batch.Add("8B 0D ? ? ? ? 85 C9", 1);
+//   batch.Scan();
+//   auto p = a.Count(1).GetFirst(1);
+class PatternBatch
+{
+public:
+    // Scans the process main module
+    PatternBatch();
+
+    explicit PatternBatch(void* module);
+
+    PatternBatch(uintptr_t begin, uintptr_t end);
+
+    // Adds a pattern in IDA format, stopping after |maxCount| matches. The returned pattern lives as long as the
+    // batch and behaves like a standalone one after Scan(), Count/CountHint/GetOne keep the first matches as a scan
+    // of its own would have stopped there; used before that, it simply scans on its own.
+    template <size_t Len>
+    Pattern& Add(const char (&pattern)[Len], uint32_t maxCount = UINT32_MAX)
+    {
+        return Add(std::string_view(pattern, Len - 1), maxCount);
+    }
+
+    Pattern& Add(std::string_view pattern, uint32_t maxCount = UINT32_MAX);
+
+    // Resolves every pattern added so far that hasn't been matched yet
+    void Scan();
+
+    size_t Size() const { return m_entries.size(); }
+
+private:
+    struct Entry
+    {
+        std::unique_ptr<Pattern> pattern;
+        uint32_t maxCount;
+    };
+
+    std::unique_ptr<Pattern> MakePattern() const;
+
+    std::vector<Entry> m_entries;
+
+    bool m_isRange;
+    void* m_module;
+    uintptr_t m_rangeStart;
+    uintptr_t m_rangeEnd;
+};
+
+}  // namespace hook
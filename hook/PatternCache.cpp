@@ -0,0 +1,279 @@
+// Persistent pattern resolution cache
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#include "client/hook/PatternCache.hpp"
+
+#if defined(OS_WIN)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+namespace hook
+{
+
+static const uint32_t kCacheMagic = 0x43504B48;  // "HKPC"
+static const uint32_t kCacheVersion = 3;
+static const uint32_t kCacheCapacity = 8192;
+static const uint32_t kMaxProbes = 16;
+
+// Reserved keys
+static const uint64_t kEmptyKey = 0;
+static const uint64_t kDeletedKey = 1;
+
+static PatternCache* currentCache;
+
+PatternCache::PatternCache() :
+#if defined(OS_WIN)
+    m_file(nullptr),
+    m_mapping(nullptr),
+#else
+    m_file(-1),
+#endif
+    m_header(nullptr),
+    m_records(nullptr)
+{
+}
+
+PatternCache::~PatternCache()
+{
+    Unmap();
+}
+
+bool PatternCache::Open(const char* path)
+{
+    Close();
+
+    auto cache = new PatternCache();
+
+    if (!cache->Map(path))
+    {
+        delete cache;
+        return false;
+    }
+
+    currentCache = cache;
+    return true;
+}
+
+void PatternCache::Close()
+{
+    delete currentCache;
+    currentCache = nullptr;
+}
+
+PatternCache* PatternCache::Get()
+{
+    return currentCache;
+}
+
+uint64_t PatternCache::MakeKey(uint64_t moduleIdentity, const std::string& bytes, const std::string& mask,
+    uint32_t maxCount, const uint64_t* hintRVA)
+{
+    // FNV-1a
+    uint64_t hash = 0xCBF29CE484222325ull;
+
+    auto feed = [&](const void* data, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= static_cast<const uint8_t*>(data)[i];
+            hash *= 0x100000001B3ull;
+        }
+    };
+
+    feed(&moduleIdentity, sizeof(moduleIdentity));
+    feed(&maxCount, sizeof(maxCount));
+    feed(bytes.data(), bytes.size());
+    feed(mask.data(), mask.size());
+
+    if (hintRVA)
+    {
+        feed(hintRVA, sizeof(*hintRVA));
+    }
+
+    return std::max(hash, kDeletedKey + 1);
+}
+
+bool PatternCache::Lookup(uint64_t key, uint32_t (&rvas)[kMaxMatches], uint32_t& count)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Record* record = FindSlot(key);
+
+    if (record->key != key || record->count > kMaxMatches)
+    {
+        return false;
+    }
+
+    count = record->count;
+    std::copy(record->rvas, record->rvas + count, rvas);
+    return true;
+}
+
+void PatternCache::Store(uint64_t key, const uint32_t* rvas, uint32_t count)
+{
+    if (count > kMaxMatches)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Record* record = FindSlot(key);
+
+    record->key = key;
+    record->count = count;
+    std::copy(rvas, rvas + count, record->rvas);
+}
+
+void PatternCache::Invalidate(uint64_t key)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Record* record = FindSlot(key);
+
+    if (record->key == key)
+    {
+        record->key = kDeletedKey;
+    }
+}
+
+PatternCache::Record* PatternCache::FindSlot(uint64_t key)
+{
+    const uint32_t home = static_cast<uint32_t>(key % kCacheCapacity);
+    Record* reusable = nullptr;
+
+    for (uint32_t i = 0; i < kMaxProbes; i++)
+    {
+        Record* record = &m_records[(home + i) % kCacheCapacity];
+
+        if (record->key == key)
+        {
+            return record;
+        }
+
+        if (record->key == kEmptyKey)
+        {
+            return reusable ? reusable : record;
+        }
+
+        if (record->key == kDeletedKey && !reusable)
+        {
+            reusable = record;
+        }
+    }
+
+    // Table is crowded around here, evict the home slot
+    return reusable ? reusable : &m_records[home];
+}
+
+bool PatternCache::Map(const char* path)
+{
+    const size_t size = sizeof(Header) + kCacheCapacity * sizeof(Record);
+
+#if defined(OS_WIN)
+    HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    m_file = file;
+
+    // Grows the file to the table size if it's new or truncated
+    m_mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, 0, static_cast<DWORD>(size), nullptr);
+
+    if (!m_mapping)
+    {
+        return false;
+    }
+
+    m_header = static_cast<Header*>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+#else
+    m_file = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    if (m_file < 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+
+    if (fstat(m_file, &info) != 0 || (static_cast<size_t>(info.st_size) < size && ftruncate(m_file, size) != 0))
+    {
+        return false;
+    }
+
+    void* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+    m_header = view != MAP_FAILED ? static_cast<Header*>(view) : nullptr;
+#endif
+
+    if (!m_header)
+    {
+        return false;
+    }
+
+    m_records = reinterpret_cast<Record*>(m_header + 1);
+
+    if (m_header->magic != kCacheMagic || m_header->version != kCacheVersion || m_header->capacity != kCacheCapacity)
+    {
+        memset(m_header, 0, size);
+
+        m_header->magic = kCacheMagic;
+        m_header->version = kCacheVersion;
+        m_header->capacity = kCacheCapacity;
+    }
+
+    return true;
+}
+
+void PatternCache::Unmap()
+{
+#if defined(OS_WIN)
+    if (m_header)
+    {
+        UnmapViewOfFile(m_header);
+    }
+
+    if (m_mapping)
+    {
+        CloseHandle(m_mapping);
+    }
+
+    if (m_file)
+    {
+        CloseHandle(m_file);
+    }
+
+    m_mapping = nullptr;
+    m_file = nullptr;
+#else
+    if (m_header)
+    {
+        munmap(m_header, sizeof(Header) + kCacheCapacity * sizeof(Record));
+    }
+
+    if (m_file >= 0)
+    {
+        close(m_file);
+    }
+
+    m_file = -1;
+#endif
+
+    m_header = nullptr;
+    m_records = nullptr;
+}
+
+}  // namespace hook
@@ -0,0 +1,91 @@
+// Persistent pattern resolution cache
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+
+#include "build/BuildConfig.hpp"
+
+namespace hook
+{
+
+// Memory-mapped table of resolved RVAs, keyed by a hash of the module identity, the pattern bytes/mask and the
+// requested match count. Once opened, every module scan consults it: a hit is only re-verified in place instead of
+// scanning, a failed verification drops the record and falls back to a full scan. Open it before resolving patterns
+// and close it after, it's not meant to be swapped while scans are running.
+class PatternCache
+{
+public:
+    // Patterns with more matches than this aren't cached
+    static const uint32_t kMaxMatches = 5;
+
+    // Maps the cache file at |path|, creating or resetting it if needed
+    static bool Open(const char* path);
+
+    static void Close();
+
+    // Returns the open cache, or nullptr
+    static PatternCache* Get();
+
+    // |hintRVA| is given for scans that start from a hint, which may find other matches than a full scan
+    static uint64_t MakeKey(uint64_t moduleIdentity, const std::string& bytes, const std::string& mask,
+        uint32_t maxCount, const uint64_t* hintRVA = nullptr);
+
+    bool Lookup(uint64_t key, uint32_t (&rvas)[kMaxMatches], uint32_t& count);
+
+    void Store(uint64_t key, const uint32_t* rvas, uint32_t count);
+
+    void Invalidate(uint64_t key);
+
+    PatternCache(const PatternCache&) = delete;
+    PatternCache& operator=(const PatternCache&) = delete;
+
+private:
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t capacity;
+        uint32_t reserved;
+    };
+
+    struct Record
+    {
+        uint64_t key;
+        uint32_t count;
+        uint32_t rvas[kMaxMatches];
+    };
+
+    PatternCache();
+    ~PatternCache();
+
+    bool Map(const char* path);
+    void Unmap();
+
+    // Returns the slot holding |key|, or the slot it should go to if it isn't cached
+    Record* FindSlot(uint64_t key);
+
+#if defined(OS_WIN)
+    void* m_file;
+    void* m_mapping;
+#else
+    int m_file;
+#endif
+
+    Header* m_header;
+    Record* m_records;
+
+    std::mutex m_mutex;
+};
+
+}  // namespace hook
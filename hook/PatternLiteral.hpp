@@ -0,0 +1,344 @@
+// Compile-time code patterns
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+
+#include "client/hook/ExecutableMeta.hpp"
+#include "client/hook/Pattern.hpp"
+
+namespace hook
+{
+
+namespace pattern_literal
+{
+
+constexpr int HexValue(char ch)
+{
+    return (ch >= '0' && ch <= '9') ? ch - '0' :
+        (ch >= 'A' && ch <= 'F') ? ch - 'A' + 10 : (ch >= 'a' && ch <= 'f') ? ch - 'a' + 10 : -1;
+}
+
+// Whether a byte starts at |ch|: at the start of the pattern, after a space or after a capture or result marker. A
+// '?' followed by a hex digit only opens a nibble there, elsewhere it's a wildcard byte of its own.
+constexpr bool IsByteStart(const char* pattern, const char* ch)
+{
+    return ch == pattern || ch[-1] == ' ' || ch[-1] == '[' || ch[-1] == '<' || ch[-1] == ']' || ch[-1] == '>' ||
+        ch[-1] == '$';
+}
+
+// Not constexpr on purpose: reaching it while a pattern is evaluated at compile time is a compile error
+inline void MalformedPattern()
+{
+    assert(false && "Malformed pattern");
+}
+
+// Walks an IDA-style pattern, calling |emit(index, value, mask)| for every byte. Same syntax as Pattern: two hex digits
+// with '?' for an open nibble ("4?"), a lone '?' for a wildcard byte, and an optional "&" mask in hex ("C0&F8").
+// "?5" is only a nibble where a byte starts (see IsByteStart), "??AB" is two wildcards and AB. Unlike
+// TransformPattern it doesn't skip over anything it doesn't understand, and captures aren't supported.
+template <typename Emit>
+constexpr size_t Parse(const char* pattern, Emit&& emit)
+{
+    size_t count = 0;
+
+    for (const char* ch = pattern; *ch != '\0';)
+    {
+        if (*ch == ' ')
+        {
+            ch++;
+        }
+        else if (*ch == '?' && (HexValue(ch[1]) < 0 || !IsByteStart(pattern, ch)))
+        {
+            emit(count++, uint8_t(0), uint8_t(0));
+            ch++;
+        }
+        else
+        {
+            const int high = ch[0] == '?' ? 0 : HexValue(ch[0]);
+            const int low = high >= 0 ? (ch[1] == '?' ? 0 : HexValue(ch[1])) : -1;
+
+            if (high < 0 || low < 0)
+            {
+                MalformedPattern();
+                return count;
+            }
+
+            int mask = (ch[0] == '?' ? 0x00 : 0xF0) | (ch[1] == '?' ? 0x00 : 0x0F);
+            ch += 2;
+
+            if (*ch == '&')
+            {
+                const int maskHigh = HexValue(ch[1]);
+                const int maskLow = maskHigh >= 0 ? HexValue(ch[2]) : -1;
+
+                if (maskHigh < 0 || maskLow < 0)
+                {
+                    MalformedPattern();
+                    return count;
+                }
+
+                mask &= (maskHigh << 4) | maskLow;
+                ch += 3;
+            }
+
+            emit(count++, static_cast<uint8_t>(((high << 4) | low) & mask), static_cast<uint8_t>(mask));
+        }
+    }
+
+    if (count == 0)
+    {
+        MalformedPattern();
+    }
+
+    return count;
+}
+
+constexpr size_t CountBytes(const char* pattern)
+{
+    return Parse(pattern, [](size_t, uint8_t, uint8_t) {});
+}
+
+}  // namespace pattern_literal
+
+// Pattern parsed at compile time into fixed byte/mask tables, with its Horspool skip table precomputed. Build one
+// with HOOK_PATTERN so malformed patterns fail to compile.
+template <size_t N>
+struct PatternLiteral
+{
+    // Byte i matches when (data[i] & mask[i]) == bytes[i]
+    std::array<uint8_t, N> bytes;
+    std::array<uint8_t, N> mask;
+
+    // Shift for the byte under the last position of the window, saturated to 255
+    std::array<uint8_t, 256> skip;
+
+    constexpr explicit PatternLiteral(const char* pattern) :
+        bytes(),
+        mask(),
+        skip()
+    {
+        const size_t count = pattern_literal::Parse(pattern, [this](size_t index, uint8_t value, uint8_t valueMask)
+        {
+            if (index < N)
+            {
+                bytes[index] = value;
+                mask[index] = valueMask;
+            }
+        });
+
+        if (count != N)
+        {
+            pattern_literal::MalformedPattern();
+        }
+
+        // A wildcard matches anything, the window can never move past the last one
+        size_t defaultShift = N;
+
+        for (size_t i = 0; i + 1 < N; i++)
+        {
+            if (mask[i] == 0)
+            {
+                defaultShift = N - 1 - i;
+            }
+        }
+
+        for (auto& shift : skip)
+        {
+            shift = static_cast<uint8_t>(std::min<size_t>(defaultShift, 255));
+        }
+
+        // A partly masked byte stands for every value it matches
+        for (size_t i = 0; i + 1 < N; i++)
+        {
+            for (size_t value = 0; value < 256 && mask[i] != 0; value++)
+            {
+                if ((value & mask[i]) == bytes[i])
+                {
+                    skip[value] = static_cast<uint8_t>(std::min<size_t>(skip[value], N - 1 - i));
+                }
+            }
+        }
+    }
+
+    static constexpr size_t Size() { return N; }
+
+    // N is a constant, so the compiler is free to unroll this
+    constexpr bool MatchesAt(const uint8_t* ptr) const
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            if ((ptr[i] & mask[i]) != bytes[i])
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+};
+
+// Heap-free counterpart of Pattern, meant for static instances. Keeps up to |MaxMatches| matches inline.
+//
+// Usage:
+//   static StaticPattern s_pattern(HOOK_PATTERN("E8 ? ? ? ? 84 C0 74 12"));
+//   auto p = s_pattern.Count(1).GetFirst(1);
+template <size_t N, size_t MaxMatches = 1>
+class StaticPattern
+{
+public:
+    // Scans the process main module
+    constexpr explicit StaticPattern(const PatternLiteral<N>& literal) :
+        m_literal(literal), m_matches(), m_count(0), m_module(nullptr), m_rangeStart(0), m_rangeEnd(0),
+        m_matched(false)
+    {}
+
+    constexpr StaticPattern(void* module, const PatternLiteral<N>& literal) :
+        m_literal(literal), m_matches(), m_count(0), m_module(module), m_rangeStart(0), m_rangeEnd(0),
+        m_matched(false)
+    {}
+
+    constexpr StaticPattern(uintptr_t begin, uintptr_t end, const PatternLiteral<N>& literal) :
+        m_literal(literal), m_matches(), m_count(0), m_module(nullptr), m_rangeStart(begin), m_rangeEnd(end),
+        m_matched(false)
+    {}
+
+    StaticPattern& Count(uint32_t expected)
+    {
+        assert(expected <= MaxMatches);
+        EnsureMatches(expected);
+        assert(m_count == expected);
+        return *this;
+    }
+
+    StaticPattern& CountHint(uint32_t expected)
+    {
+        EnsureMatches(expected);
+        return *this;
+    }
+
+    StaticPattern& Clear()
+    {
+        m_count = 0;
+        m_matched = false;
+        return *this;
+    }
+
+    // Counts every match, even past the ones kept inline
+    size_t Size()
+    {
+        EnsureMatches(UINT32_MAX);
+        return m_count;
+    }
+
+    bool Empty() { return Size() == 0; }
+
+    PatternMatch Get(size_t index)
+    {
+        EnsureMatches(UINT32_MAX);
+        return GetInternal(index);
+    }
+
+    PatternMatch GetOne() { return Count(1).GetInternal(0); }
+
+    template <typename T = void>
+    auto GetFirst(ptrdiff_t offset = 0)
+    {
+        return GetOne().template Get<T>(offset);
+    }
+
+private:
+    PatternMatch GetInternal(size_t index) const
+    {
+        assert(index < std::min(m_count, MaxMatches));
+        return PatternMatch(m_matches[index]);
+    }
+
+    void EnsureMatches(uint32_t maxCount)
+    {
+        if (m_matched)
+        {
+            return;
+        }
+
+        ExecutableMeta executable = m_rangeStart != 0 && m_rangeEnd != 0 ?
+            ExecutableMeta(m_rangeStart, m_rangeEnd) :
+            ExecutableMeta(m_module ? m_module : GetRVA<void>(0));
+
+        m_matched = true;
+
+        for (size_t i = 0; i < executable.rangeCount(); i++)
+        {
+            if (!ScanRange(executable.ranges()[i], maxCount))
+            {
+                break;
+            }
+        }
+    }
+
+    // Returns false once |maxCount| is reached
+    bool ScanRange(const ExecutableMeta::Range& range, uint32_t maxCount)
+    {
+        const uint8_t* ptr = reinterpret_cast<const uint8_t*>(range.begin);
+        const uint8_t* end = reinterpret_cast<const uint8_t*>(range.end);
+
+        if (end - ptr < static_cast<ptrdiff_t>(N))
+        {
+            return true;
+        }
+
+        for (const uint8_t* last = end - N; ptr <= last;)
+        {
+            if (!m_literal.MatchesAt(ptr))
+            {
+                ptr += m_literal.skip[ptr[N - 1]];
+                continue;
+            }
+
+            if (m_count < MaxMatches)
+            {
+                m_matches[m_count] = const_cast<uint8_t*>(ptr);
+            }
+
+            if (++m_count == maxCount)
+            {
+                return false;
+            }
+
+            ptr++;
+        }
+
+        return true;
+    }
+
+    PatternLiteral<N> m_literal;
+
+    std::array<void*, MaxMatches> m_matches;
+    size_t m_count;
+
+    void* m_module;
+    uintptr_t m_rangeStart;
+    uintptr_t m_rangeEnd;
+
+    bool m_matched;
+};
+
+}  // namespace hook
+
+// Parses an IDA-style pattern at compile time, malformed hex fails to compile
+#define HOOK_PATTERN(pattern)                                                                                     \
+    ([]() constexpr {                                                                                             \
+        constexpr ::hook::PatternLiteral<::hook::pattern_literal::CountBytes(pattern)> literal(pattern);          \
+        return literal;                                                                                           \
+    }())
@@ -0,0 +1,503 @@
+// Pattern scanning kernels
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#include "client/hook/PatternScanner.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+#include "build/BuildConfig.hpp"
+
+#if defined(ARCH_CPU_X86_FAMILY)
+#if defined(COMPILER_MSVC)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(COMPILER_MSVC)
+#define HOOK_TARGET_AVX2
+#else
+#define HOOK_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace hook
+{
+
+// Rough frequency of each byte value in x86/x64 code, higher is more common. Only the ordering matters, it's used to
+// anchor the vector kernels on the bytes that produce the fewest false candidates.
+static const uint8_t kByteFrequency[256] =
+{
+    255, 110,  85,  75, 105,  60,  60,  40, 100,  45,  12,  45,  70,  50,  35, 150,
+    100,  35,  40,  35,  60,  60,  35,  12,  70,  12,  12,  12,  50,  12,  12,  35,
+     90,  12,  12,  45, 150,  50,  12,  12,  65,  12,  12,  45,  35,  12,  12,  12,
+     65,  45,  12,  80,  30,  12,  12,  12,  65,  60,  12,  60,  45,  12,  12,  12,
+     95,  90,  30,  30, 140, 110,  30,  30, 185,  70,  30,  30, 125,  50,  30,  30,
+     70,  35,  35,  60,  35,  60,  60,  60,  35,  35,  35,  60,  12,  60,  60,  60,
+     40,  12,  12,  45,  12,  12,  35,  12,  60,  12,  60,  12,  12,  12,  12,  12,
+     40,  12,  40,  40, 115, 100,  40,  40,  16,  12,  12,  12,  50,  40,  40,  12,
+     70,  60,  12, 140,  70, 115,  12,  12,  50, 160,  50, 190,  12, 120,  45,  12,
+     90,  12,  12,  12,  12,  12,  12,  12,  16,  12,  12,  12,  12,  12,  12,  12,
+     24,  12,  12,  12,  12,  12,  12,  12,  16,  12,  12,  12,  12,  12,  12,  12,
+     24,  12,  12,  12,  12,  12,  12,  12,  30,  30,  30,  12,  12,  12,  12,  12,
+    100,  50,  12,  80,  12,  12,  50,  95,  40,  12,  12,  12, 170,  12,  12,  12,
+     40,  12,  12,  12,  30,  12,  12,  12,  55,  12,  12,  12,  30,  12,  12,  12,
+     40,  12,  12,  12,  30,  12,  12,  12, 135,  70,  12,  70,  30,  12,  12,  12,
+     40,  12,  35,  35,  30,  12,  45,  12,  50,  12,  12,  12,  30,  12,  50, 200,
+};
+
+#if defined(ARCH_CPU_X86_FAMILY)
+
+static void Cpuid(int info[4], int leaf, int subLeaf = 0)
+{
+#if defined(COMPILER_MSVC)
+    __cpuidex(info, leaf, subLeaf);
+#else
+    unsigned int regs[4];
+    __cpuid_count(leaf, subLeaf, regs[0], regs[1], regs[2], regs[3]);
+    std::copy(std::begin(regs), std::end(regs), info);
+#endif
+}
+
+static uint64_t ReadXCR0()
+{
+#if defined(COMPILER_MSVC)
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+
+static bool CpuHasSSE2()
+{
+#if defined(ARCH_CPU_X86_64)
+    return true;
+#else
+    int info[4];
+    Cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#endif
+}
+
+static bool CpuHasAVX2()
+{
+    int info[4];
+    Cpuid(info, 0);
+
+    if (info[0] < 7)
+    {
+        return false;
+    }
+
+    // The OS has to save the YMM state as well, or using AVX faults
+    Cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+
+    if (!osxsave || !avx || (ReadXCR0() & 0x6) != 0x6)
+    {
+        return false;
+    }
+
+    Cpuid(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+}
+
+static inline uint32_t CountTrailingZeros(uint32_t value)
+{
+#if defined(COMPILER_MSVC)
+    unsigned long index;
+    _BitScanForward(&index, value);
+    return index;
+#else
+    return __builtin_ctz(value);
+#endif
+}
+
+#endif  // ARCH_CPU_X86_FAMILY
+
+struct PatternKernels
+{
+    // Boyer-Moore-Horspool, the reference implementation every other kernel has to agree with
+    static const uint8_t* Scalar(const PatternScanner& scanner, const uint8_t* begin, const uint8_t* end)
+    {
+        const uint8_t* pattern = scanner.m_bytes;
+        const uint8_t* mask = scanner.m_mask;
+        const size_t size = scanner.m_size;
+
+        if (end < begin || static_cast<size_t>(end - begin) < size)
+        {
+            return nullptr;
+        }
+
+        for (const uint8_t *ptr = begin, *last = end - size; ptr <= last;)
+        {
+            ptrdiff_t j = size - 1;
+
+            while ((j >= 0) && (ptr[j] & mask[j]) == pattern[j])
+                j--;
+
+            if (j < 0)
+            {
+                return ptr;
+            }
+
+            ptr += std::max<ptrdiff_t>(1, j - scanner.m_last[ptr[j]]);
+        }
+
+        return nullptr;
+    }
+
+#if defined(ARCH_CPU_X86_FAMILY)
+    // Compares both (masked) anchors for 16 candidates at a time, only survivors get a full mask check
+    static const uint8_t* SSE2(const PatternScanner& scanner, const uint8_t* begin, const uint8_t* end)
+    {
+        if (scanner.m_anchorCount == 0 || end < begin || static_cast<size_t>(end - begin) < scanner.m_size + 16)
+        {
+            return Scalar(scanner, begin, end);
+        }
+
+        const uint8_t* first = begin + scanner.m_anchors[0];
+        const uint8_t* second = begin + scanner.m_anchors[1];
+        const __m128i firstByte = _mm_set1_epi8(static_cast<char>(scanner.m_bytes[scanner.m_anchors[0]]));
+        const __m128i secondByte = _mm_set1_epi8(static_cast<char>(scanner.m_bytes[scanner.m_anchors[1]]));
+        const __m128i firstMask = _mm_set1_epi8(static_cast<char>(scanner.m_mask[scanner.m_anchors[0]]));
+        const __m128i secondMask = _mm_set1_epi8(static_cast<char>(scanner.m_mask[scanner.m_anchors[1]]));
+
+        const uint8_t* last = end - scanner.m_size;
+        ptrdiff_t i = 0;
+
+        for (const ptrdiff_t blocks = (last - begin + 1) & ~ptrdiff_t(15); i < blocks; i += 16)
+        {
+            const __m128i a = _mm_cmpeq_epi8(firstByte,
+                _mm_and_si128(firstMask, _mm_loadu_si128(reinterpret_cast<const __m128i*>(first + i))));
+            const __m128i b = _mm_cmpeq_epi8(secondByte,
+                _mm_and_si128(secondMask, _mm_loadu_si128(reinterpret_cast<const __m128i*>(second + i))));
+
+            for (uint32_t bits = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(a, b))); bits != 0;
+                 bits &= bits - 1)
+            {
+                const uint8_t* candidate = begin + i + CountTrailingZeros(bits);
+
+                if (scanner.MatchesAt(candidate))
+                {
+                    return candidate;
+                }
+            }
+        }
+
+        return Scalar(scanner, begin + i, end);
+    }
+
+    // Same as SSE2, with 32 candidates per iteration
+    HOOK_TARGET_AVX2 static const uint8_t* AVX2(const PatternScanner& scanner, const uint8_t* begin,
+        const uint8_t* end)
+    {
+        if (scanner.m_anchorCount == 0 || end < begin || static_cast<size_t>(end - begin) < scanner.m_size + 32)
+        {
+            return SSE2(scanner, begin, end);
+        }
+
+        const uint8_t* first = begin + scanner.m_anchors[0];
+        const uint8_t* second = begin + scanner.m_anchors[1];
+        const __m256i firstByte = _mm256_set1_epi8(static_cast<char>(scanner.m_bytes[scanner.m_anchors[0]]));
+        const __m256i secondByte = _mm256_set1_epi8(static_cast<char>(scanner.m_bytes[scanner.m_anchors[1]]));
+        const __m256i firstMask = _mm256_set1_epi8(static_cast<char>(scanner.m_mask[scanner.m_anchors[0]]));
+        const __m256i secondMask = _mm256_set1_epi8(static_cast<char>(scanner.m_mask[scanner.m_anchors[1]]));
+
+        const uint8_t* last = end - scanner.m_size;
+        ptrdiff_t i = 0;
+
+        for (const ptrdiff_t blocks = (last - begin + 1) & ~ptrdiff_t(31); i < blocks; i += 32)
+        {
+            const __m256i a = _mm256_cmpeq_epi8(firstByte,
+                _mm256_and_si256(firstMask, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first + i))));
+            const __m256i b = _mm256_cmpeq_epi8(secondByte,
+                _mm256_and_si256(secondMask, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(second + i))));
+
+            for (uint32_t bits = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(a, b))); bits != 0;
+                 bits &= bits - 1)
+            {
+                const uint8_t* candidate = begin + i + CountTrailingZeros(bits);
+
+                if (scanner.MatchesAt(candidate))
+                {
+                    return candidate;
+                }
+            }
+        }
+
+        return SSE2(scanner, begin + i, end);
+    }
+#endif  // ARCH_CPU_X86_FAMILY
+
+    // Looks every position up in the exact key set
+    static size_t PairScalar(const PairFilter& filter, const uint8_t*& begin, const uint8_t* end, const uint8_t** out,
+        size_t capacity)
+    {
+        size_t count = 0;
+
+        for (; begin < end && count < capacity; begin++)
+        {
+            if (filter.MatchesAt(begin, end))
+            {
+                out[count++] = begin;
+            }
+        }
+
+        return count;
+    }
+
+#if defined(ARCH_CPU_X86_FAMILY)
+    // A position passes if the nibbles of both of its bytes share a bucket, only those are looked up in the exact set
+    HOOK_TARGET_AVX2 static size_t PairAVX2(const PairFilter& filter, const uint8_t*& begin, const uint8_t* end,
+        const uint8_t** out, size_t capacity)
+    {
+        // The second byte of the last position in a block comes from the next one
+        if (end < begin || end - begin < 33)
+        {
+            return PairScalar(filter, begin, end, out, capacity);
+        }
+
+        const __m256i nibbleMask = _mm256_set1_epi8(0x0F);
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i firstLow =
+            _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(filter.m_nibbles[0])));
+        const __m256i firstHigh =
+            _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(filter.m_nibbles[1])));
+        const __m256i secondLow =
+            _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(filter.m_nibbles[2])));
+        const __m256i secondHigh =
+            _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(filter.m_nibbles[3])));
+
+        const ptrdiff_t blocks = (end - begin - 1) & ~ptrdiff_t(31);
+        ptrdiff_t i = 0;
+        size_t count = 0;
+
+        // A block is only started while all of its positions would fit
+        for (; i < blocks && capacity - count >= 32; i += 32)
+        {
+            const __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin + i));
+            const __m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin + i + 1));
+
+            const __m256i a = _mm256_and_si256(
+                _mm256_shuffle_epi8(firstLow, _mm256_and_si256(first, nibbleMask)),
+                _mm256_shuffle_epi8(firstHigh, _mm256_and_si256(_mm256_srli_epi16(first, 4), nibbleMask)));
+            const __m256i b = _mm256_and_si256(
+                _mm256_shuffle_epi8(secondLow, _mm256_and_si256(second, nibbleMask)),
+                _mm256_shuffle_epi8(secondHigh, _mm256_and_si256(_mm256_srli_epi16(second, 4), nibbleMask)));
+
+            const uint32_t passed =
+                ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(a, b), zero)));
+
+            for (uint32_t bits = passed; bits != 0; bits &= bits - 1)
+            {
+                const uint8_t* candidate = begin + i + CountTrailingZeros(bits);
+
+                if (filter.MatchesAt(candidate, end))
+                {
+                    out[count++] = candidate;
+                }
+            }
+        }
+
+        begin += i;
+
+        if (i < blocks)
+        {
+            return count;
+        }
+
+        return count + PairScalar(filter, begin, end, out + count, capacity - count);
+    }
+#endif  // ARCH_CPU_X86_FAMILY
+};
+
+PatternScanner::PatternScanner(const uint8_t* bytes, const uint8_t* mask, size_t size) :
+    m_bytes(bytes),
+    m_mask(mask),
+    m_size(size),
+    m_anchors(),
+    m_anchorCount(0),
+    m_kernel(SelectKernel())
+{
+    ptrdiff_t lastWild = -1;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        if (mask[i] == 0)
+        {
+            lastWild = static_cast<ptrdiff_t>(i);
+        }
+    }
+
+    // A wildcard matches any byte, so no shift may ever go past the last one
+    std::fill(std::begin(m_last), std::end(m_last), lastWild);
+
+    for (size_t i = 0; i < size; i++)
+    {
+        if (mask[i] == 0)
+        {
+            continue;
+        }
+
+        // A partly masked byte stands for every value it matches
+        if (mask[i] == 0xFF)
+        {
+            m_last[bytes[i]] = std::max(m_last[bytes[i]], static_cast<ptrdiff_t>(i));
+        }
+        else
+        {
+            for (size_t value = 0; value < 256; value++)
+            {
+                if ((value & mask[i]) == bytes[i])
+                {
+                    m_last[value] = std::max(m_last[value], static_cast<ptrdiff_t>(i));
+                }
+            }
+        }
+
+        // Keep the two rarest bytes as anchors
+        const uint8_t frequency = MaskedFrequency(bytes[i], mask[i]);
+
+        if (m_anchorCount == 0 || frequency < MaskedFrequency(bytes[m_anchors[0]], mask[m_anchors[0]]))
+        {
+            m_anchors[1] = m_anchors[0];
+            m_anchors[0] = i;
+            m_anchorCount = std::min<size_t>(m_anchorCount + 1, 2);
+        }
+        else if (m_anchorCount == 1 || frequency < MaskedFrequency(bytes[m_anchors[1]], mask[m_anchors[1]]))
+        {
+            m_anchors[1] = i;
+            m_anchorCount = 2;
+        }
+    }
+
+    // A single anchor is compared twice
+    if (m_anchorCount == 1)
+    {
+        m_anchors[1] = m_anchors[0];
+    }
+}
+
+uint8_t PatternScanner::ByteFrequency(uint8_t value)
+{
+    return kByteFrequency[value];
+}
+
+uint8_t PatternScanner::MaskedFrequency(uint8_t value, uint8_t mask)
+{
+    if (mask == 0xFF)
+    {
+        return kByteFrequency[value];
+    }
+
+    unsigned frequency = 0;
+
+    for (unsigned other = 0; other < 256 && frequency < 255; other++)
+    {
+        if ((other & mask) == value)
+        {
+            frequency += kByteFrequency[other];
+        }
+    }
+
+    return static_cast<uint8_t>(std::min(frequency, 255u));
+}
+
+PairFilter::PairFilter() :
+    m_pairs(),
+    m_bytes(),
+    m_nibbles(),
+    m_kernel(SelectKernel())
+{
+}
+
+// Keys are bucketed by the low bits of their first byte, so a bucket only ever sees two low nibbles there
+void PairFilter::AddPair(uint8_t first, uint8_t second)
+{
+    const uint32_t key = first | (second << 8);
+    const uint8_t bucket = static_cast<uint8_t>(1 << (first & 7));
+
+    m_pairs[key / 64] |= 1ull << (key % 64);
+
+    m_nibbles[0][first & 15] |= bucket;
+    m_nibbles[1][first >> 4] |= bucket;
+    m_nibbles[2][second & 15] |= bucket;
+    m_nibbles[3][second >> 4] |= bucket;
+}
+
+void PairFilter::AddByte(uint8_t value)
+{
+    const uint8_t bucket = static_cast<uint8_t>(1 << (value & 7));
+
+    m_bytes[value] = true;
+
+    m_nibbles[0][value & 15] |= bucket;
+    m_nibbles[1][value >> 4] |= bucket;
+
+    for (size_t nibble = 0; nibble < 16; nibble++)
+    {
+        m_nibbles[2][nibble] |= bucket;
+        m_nibbles[3][nibble] |= bucket;
+    }
+}
+
+bool PairFilter::IsVectorized()
+{
+    return SelectKernel() != &PatternKernels::PairScalar;
+}
+
+PairFilter::Kernel PairFilter::SelectKernel()
+{
+    static const Kernel kernel = []() -> Kernel
+    {
+#if defined(ARCH_CPU_X86_FAMILY)
+        if (CpuHasAVX2())
+        {
+            return &PatternKernels::PairAVX2;
+        }
+#endif
+        return &PatternKernels::PairScalar;
+    }();
+
+    return kernel;
+}
+
+const uint8_t* PatternScanner::FindNextScalar(const uint8_t* begin, const uint8_t* end) const
+{
+    return PatternKernels::Scalar(*this, begin, end);
+}
+
+PatternScanner::Kernel PatternScanner::SelectKernel()
+{
+    static const Kernel kernel = []() -> Kernel
+    {
+#if defined(ARCH_CPU_X86_FAMILY)
+        if (CpuHasAVX2())
+        {
+            return &PatternKernels::AVX2;
+        }
+
+        if (CpuHasSSE2())
+        {
+            return &PatternKernels::SSE2;
+        }
+#endif
+        return &PatternKernels::Scalar;
+    }();
+
+    return kernel;
+}
+
+}  // namespace hook
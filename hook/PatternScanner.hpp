@@ -0,0 +1,129 @@
+// Pattern scanning kernels
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace hook
+{
+
+// Compiled form of a canonical (bytes + mask) pattern, a byte matches when (byte & mask[i]) == bytes[i]. Picks the
+// rarest non-wildcard bytes as anchors and dispatches to the best scan kernel supported by the CPU. Doesn't own the
+// pattern data, so it must not outlive it.
+class PatternScanner
+{
+public:
+    PatternScanner(const uint8_t* bytes, const uint8_t* mask, size_t size);
+
+    // Returns the first match that lies entirely within [begin, end), or nullptr if there is none
+    const uint8_t* FindNext(const uint8_t* begin, const uint8_t* end) const { return m_kernel(*this, begin, end); }
+
+    // Checks the full pattern at |ptr|, which must have at least Size() readable bytes
+    bool MatchesAt(const uint8_t* ptr) const
+    {
+        for (size_t i = 0; i < m_size; i++)
+        {
+            if ((ptr[i] & m_mask[i]) != m_bytes[i])
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    size_t Size() const { return m_size; }
+
+    // Rough frequency of |value| in x86/x64 code, higher is more common
+    static uint8_t ByteFrequency(uint8_t value);
+
+    // Combined frequency of every byte matching |value| under |mask|, saturated
+    static uint8_t MaskedFrequency(uint8_t value, uint8_t mask);
+
+    // Same as FindNext, but always uses the byte-by-byte reference kernel
+    const uint8_t* FindNextScalar(const uint8_t* begin, const uint8_t* end) const;
+
+private:
+    friend struct PatternKernels;
+
+    using Kernel = const uint8_t* (*)(const PatternScanner& scanner, const uint8_t* begin, const uint8_t* end);
+
+    static Kernel SelectKernel();
+
+    const uint8_t* m_bytes;
+    const uint8_t* m_mask;
+    size_t m_size;
+
+    // Offsets of the two rarest non-wildcard bytes, used by the vector kernels to filter candidates
+    size_t m_anchors[2];
+    size_t m_anchorCount;
+
+    // Boyer-Moore-Horspool bad character table for the scalar kernel
+    ptrdiff_t m_last[256];
+
+    Kernel m_kernel;
+};
+
+// Set of two byte keys (and single byte ones) that finds where any of them starts, for scanning many patterns in one
+// pass. The vector kernel spreads the keys over eight buckets and checks the nibbles of 32 positions at once through
+// shuffle tables, only the positions that pass are looked up in the exact set.
+class PairFilter
+{
+public:
+    PairFilter();
+
+    // |first| followed by |second|
+    void AddPair(uint8_t first, uint8_t second);
+
+    // |value| followed by anything
+    void AddByte(uint8_t value);
+
+    bool HasPair(uint8_t first, uint8_t second) const
+    {
+        const uint32_t key = first | (second << 8);
+        return (m_pairs[key / 64] & (1ull << (key % 64))) != 0;
+    }
+
+    bool HasByte(uint8_t value) const { return m_bytes[value]; }
+
+    // Without AVX2 every position is looked up one by one
+    static bool IsVectorized();
+
+    // Stores the positions in [begin, end) where a key starts into |out| in address order, up to |capacity| of them,
+    // and returns how many. |begin| is moved past every position looked at, and reaches |end| once the range is done.
+    // A pair only counts if both of its bytes are in the range.
+    size_t FindAll(const uint8_t*& begin, const uint8_t* end, const uint8_t** out, size_t capacity) const
+    {
+        return m_kernel(*this, begin, end, out, capacity);
+    }
+
+private:
+    friend struct PatternKernels;
+
+    using Kernel = size_t (*)(const PairFilter& filter, const uint8_t*& begin, const uint8_t* end, const uint8_t** out,
+        size_t capacity);
+
+    static Kernel SelectKernel();
+
+    bool MatchesAt(const uint8_t* ptr, const uint8_t* end) const
+    {
+        return m_bytes[ptr[0]] || (ptr + 1 < end && HasPair(ptr[0], ptr[1]));
+    }
+
+    uint64_t m_pairs[0x10000 / 64];
+    bool m_bytes[256];
+
+    // Bucket bits allowed for the low and high nibble of the first byte, then of the second one
+    uint8_t m_nibbles[4][16];
+
+    Kernel m_kernel;
+};
+
+}  // namespace hook
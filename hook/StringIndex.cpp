@@ -0,0 +1,291 @@
+// String and data reference index
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#include "client/hook/StringIndex.hpp"
+
+#include <algorithm>
+
+namespace hook
+{
+
+// Shorter ones are too likely to be some other constant that happens to look like text
+static const size_t kMinStringLength = 2;
+
+// Longer ones are not worth looking for
+static const size_t kMaxStringLength = 4096;
+
+static bool IsTextCharacter(uint16_t character)
+{
+    return (character >= 0x20 && character < 0x7F) || character == '\t' || character == '\n' || character == '\r';
+}
+
+// Whether a NUL terminated string of text characters starts at |address| and ends before |end|
+template <typename Char>
+static bool IsString(uintptr_t address, uintptr_t end)
+{
+    if (address % sizeof(Char) != 0)
+    {
+        return false;
+    }
+
+    const Char* text = reinterpret_cast<const Char*>(address);
+
+    for (size_t length = 0; address + (length + 1) * sizeof(Char) <= end && length <= kMaxStringLength; length++)
+    {
+        if (text[length] == 0)
+        {
+            return length >= kMinStringLength;
+        }
+
+        if (!IsTextCharacter(text[length]))
+        {
+            return false;
+        }
+    }
+
+    return false;
+}
+
+// strcmp for the characters of two strings that may not be the same width
+template <typename CharA, typename CharB>
+static int CompareText(const CharA* a, const CharB* b)
+{
+    for (;; a++, b++)
+    {
+        const uint16_t left = static_cast<uint16_t>(*a);
+        const uint16_t right = static_cast<uint16_t>(*b);
+
+        if (left != right || left == 0)
+        {
+            return left < right ? -1 : (left > right ? 1 : 0);
+        }
+    }
+}
+
+// Sorts the strings at |strings| (relative to |base|) by their text
+template <typename Char>
+static void SortStrings(std::vector<uint32_t>& strings, uintptr_t base)
+{
+    std::sort(strings.begin(), strings.end(), [base](uint32_t a, uint32_t b)
+    {
+        return CompareText(reinterpret_cast<const Char*>(base + a), reinterpret_cast<const Char*>(base + b)) < 0;
+    });
+}
+
+// Strings in |strings| (relative to |base|) equal to |text|
+template <typename Char>
+static std::pair<const uint32_t*, const uint32_t*> FindStrings(const std::vector<uint32_t>& strings, uintptr_t base,
+    const char* text)
+{
+    const uint8_t* value = reinterpret_cast<const uint8_t*>(text);
+    const uint32_t* first = strings.data();
+    const uint32_t* last = first + strings.size();
+
+    first = std::lower_bound(first, last, value, [base](uint32_t string, const uint8_t* other)
+    {
+        return CompareText(reinterpret_cast<const Char*>(base + string), other) < 0;
+    });
+
+    last = std::upper_bound(first, last, value, [base](const uint8_t* other, uint32_t string)
+    {
+        return CompareText(other, reinterpret_cast<const Char*>(base + string)) < 0;
+    });
+
+    return {first, last};
+}
+
+StringIndex::StringIndex() :
+    m_executable(reinterpret_cast<void*>(ExecutableMeta::GetMainModule()))
+{
+}
+
+StringIndex::StringIndex(void* module) :
+    m_executable(module)
+{
+}
+
+StringIndex::StringIndex(uintptr_t begin, uintptr_t end) :
+    m_executable(begin, end)
+{
+}
+
+void StringIndex::Build(bool parallel)
+{
+    std::call_once(m_built, [this, parallel]()
+    {
+        m_references = CollectReferences(m_executable, parallel,
+            [this](const uint8_t* code, uintptr_t address, const Instruction& instruction, uintptr_t targets[2])
+        {
+            size_t count = 0;
+
+            // Absolute addresses also show up on x64, in images that aren't position independent
+            if (instruction.ripRelative)
+            {
+                targets[count++] = instruction.RipTarget(code, address);
+            }
+            else if (instruction.dispSize == 4)
+            {
+                targets[count++] = static_cast<uint32_t>(instruction.Displacement(code));
+            }
+
+            if (instruction.immSize == 4 && !instruction.relativeBranch)
+            {
+                targets[count++] = static_cast<uint32_t>(instruction.Immediate(code));
+            }
+
+            // Most immediates are just numbers, drop those before they take up any memory
+            if (count == 2 && !FindDataRange(targets[1]))
+            {
+                count--;
+            }
+
+            if (count != 0 && !FindDataRange(targets[0]))
+            {
+                targets[0] = targets[--count];
+            }
+
+            return count;
+        });
+
+        const uintptr_t base = m_executable.base();
+
+        for (size_t i = 0; i < m_references.size(); i++)
+        {
+            const uint32_t target = m_references[i].target;
+
+            if (i != 0 && m_references[i - 1].target == target)
+            {
+                continue;
+            }
+
+            const ExecutableMeta::Range* range = FindDataRange(base + target);
+
+            if (IsString<uint8_t>(base + target, range->end))
+            {
+                m_strings.push_back(target);
+            }
+            else if (IsString<uint16_t>(base + target, range->end))
+            {
+                m_wideStrings.push_back(target);
+            }
+        }
+
+        SortStrings<uint8_t>(m_strings, base);
+        SortStrings<uint16_t>(m_wideStrings, base);
+
+        m_strings.shrink_to_fit();
+        m_wideStrings.shrink_to_fit();
+    });
+}
+
+std::vector<PatternMatch> StringIndex::FindStringRefs(const char* text)
+{
+    Build();
+
+    const uintptr_t base = m_executable.base();
+    std::vector<uintptr_t> sources;
+
+    auto addReferences = [this, base, &sources](std::pair<const uint32_t*, const uint32_t*> strings)
+    {
+        for (const uint32_t* string = strings.first; string != strings.second; string++)
+        {
+            auto references = EqualRange(base + *string);
+
+            for (const CodeReference* reference = references.first; reference != references.second; reference++)
+            {
+                sources.push_back(base + reference->source);
+            }
+        }
+    };
+
+    addReferences(FindStrings<uint8_t>(m_strings, base, text));
+    addReferences(FindStrings<uint16_t>(m_wideStrings, base, text));
+
+    std::sort(sources.begin(), sources.end());
+    sources.erase(std::unique(sources.begin(), sources.end()), sources.end());
+
+    std::vector<PatternMatch> matches;
+    matches.reserve(sources.size());
+
+    for (uintptr_t source : sources)
+    {
+        matches.emplace_back(reinterpret_cast<void*>(source));
+    }
+
+    return matches;
+}
+
+std::vector<PatternMatch> StringIndex::FindDataRefs(MemoryPointer address)
+{
+    Build();
+
+    std::vector<PatternMatch> matches;
+    auto references = EqualRange(address.AsInt());
+
+    for (const CodeReference* reference = references.first; reference != references.second; reference++)
+    {
+        matches.emplace_back(reinterpret_cast<void*>(m_executable.base() + reference->source));
+    }
+
+    return matches;
+}
+
+size_t StringIndex::Size()
+{
+    Build();
+    return m_references.size();
+}
+
+size_t StringIndex::StringCount()
+{
+    Build();
+    return m_strings.size() + m_wideStrings.size();
+}
+
+std::pair<const CodeReference*, const CodeReference*> StringIndex::EqualRange(uintptr_t address) const
+{
+    const uintptr_t base = m_executable.base();
+
+    if (address < base || address - base > UINT32_MAX || m_references.empty())
+    {
+        return {nullptr, nullptr};
+    }
+
+    const CodeReference* first = m_references.data();
+    const CodeReference* last = first + m_references.size();
+    const CodeReference value = {static_cast<uint32_t>(address - base), 0};
+
+    return std::equal_range(first, last, value, [](const CodeReference& a, const CodeReference& b)
+    {
+        return a.target < b.target;
+    });
+}
+
+const ExecutableMeta::Range* StringIndex::FindDataRange(uintptr_t address) const
+{
+    const ExecutableMeta::Range* ranges = m_executable.dataRanges();
+    size_t count = m_executable.dataRangeCount();
+
+    if (count == 0)
+    {
+        ranges = m_executable.ranges();
+        count = m_executable.rangeCount();
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (address >= ranges[i].begin && address < ranges[i].end)
+        {
+            return &ranges[i];
+        }
+    }
+
+    return nullptr;
+}
+
+}  // namespace hook
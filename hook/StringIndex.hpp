@@ -0,0 +1,83 @@
+// String and data reference index
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <vector>
+
+#include "client/hook/ExecutableMeta.hpp"
+#include "client/hook/MemoryPointer.hpp"
+#include "client/hook/Pattern.hpp"
+#include "client/hook/XrefIndex.hpp"
+
+namespace hook
+{
+
+// Decodes the code of a module once and keeps every instruction that refers to its read-only data: immediates and
+// absolute displacements on x86, [rip + disp32] operands on x64. The referenced addresses that hold a NUL terminated
+// ASCII or UTF-16 string are kept apart, ordered by their text, so "the function that uses this string" is a pair of
+// binary searches instead of a byte pattern. Strings the linker merged into the tail of a longer one are found too.
+//
+// Usage:
+//   StringIndex strings;
+//   auto matches = strings.FindStringRefs("Couldn't load %s");
+//   if (matches.size() == 1) MakeCall(matches[0].Get<void>(5), LoadFailedHooked);
+class StringIndex
+{
+public:
+    // Indexes the process main module
+    StringIndex();
+
+    explicit StringIndex(void* module);
+
+    // Strings are looked for in the range itself, there's no read-only data to go by
+    StringIndex(uintptr_t begin, uintptr_t end);
+
+    StringIndex(const StringIndex&) = delete;
+    StringIndex& operator=(const StringIndex&) = delete;
+
+    // Decodes the code ranges, in chunks on the shared worker pool if |parallel| is set. The first lookup builds the
+    // index if this wasn't called before. Only the first call does anything.
+    void Build(bool parallel = true);
+
+    // First byte of every instruction that refers to a string equal to |text|, in address order. UTF-16 strings are
+    // only indexed when all of their characters are ASCII, and compared as such.
+    std::vector<PatternMatch> FindStringRefs(const char* text);
+
+    // First byte of every instruction that refers to |address|, in address order
+    std::vector<PatternMatch> FindDataRefs(MemoryPointer address);
+
+    // Number of references to read-only data in the index
+    size_t Size();
+
+    // Number of distinct referenced strings
+    size_t StringCount();
+
+private:
+    // Range of references to |address|
+    std::pair<const CodeReference*, const CodeReference*> EqualRange(uintptr_t address) const;
+
+    // Read-only data the string or reference at |address| has to be in, nullptr if none
+    const ExecutableMeta::Range* FindDataRange(uintptr_t address) const;
+
+    ExecutableMeta m_executable;
+
+    std::vector<CodeReference> m_references;
+
+    // Relative to the module base, ordered by text
+    std::vector<uint32_t> m_strings;
+    std::vector<uint32_t> m_wideStrings;
+
+    std::once_flag m_built;
+};
+
+}  // namespace hook
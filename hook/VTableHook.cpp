@@ -0,0 +1,175 @@
+// Virtual method table hooks
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#include "client/hook/VTableHook.hpp"
+#include "client/hook/ExecutableMeta.hpp"
+#include "client/hook/PatchTransaction.hpp"
+
+#if defined(OS_WIN)
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#include <algorithm>
+
+namespace hook
+{
+
+// Stop counting here even if the table seems to go on
+static const size_t kMaxSlots = 1024;
+
+static bool IsCode(void* address)
+{
+#if defined(OS_WIN)
+    MEMORY_BASIC_INFORMATION info;
+
+    if (!VirtualQuery(address, &info, sizeof(info)) || info.State != MEM_COMMIT)
+    {
+        return false;
+    }
+
+    return (info.Protect & (PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY)) != 0;
+#else
+    Dl_info info;
+
+    if (!dladdr(address, &info) || !info.dli_fbase)
+    {
+        return false;
+    }
+
+    ExecutableMeta meta(info.dli_fbase);
+    const uintptr_t value = reinterpret_cast<uintptr_t>(address);
+
+    for (size_t i = 0; i < meta.rangeCount(); i++)
+    {
+        if (value >= meta.ranges()[i].begin && value < meta.ranges()[i].end)
+        {
+            return true;
+        }
+    }
+
+    return false;
+#endif
+}
+
+VTableHook::VTableHook(void* object, Mode mode, size_t slotCount) :
+    m_mode(mode),
+    m_vtable(object ? *static_cast<void***>(object) : nullptr),
+    m_slotCount(0)
+{
+    if (!m_vtable)
+    {
+        return;
+    }
+
+    if (slotCount == 0)
+    {
+        while (slotCount < kMaxSlots && IsCode(m_vtable[slotCount]))
+        {
+            slotCount++;
+        }
+    }
+
+    if (slotCount == 0)
+    {
+        return;
+    }
+
+    m_slotCount = slotCount;
+    m_originals.assign(m_vtable, m_vtable + slotCount);
+
+    if (m_mode == kPerInstance)
+    {
+        m_shadow.reset(new void*[kPrefixSlots + slotCount]);
+        std::copy(m_vtable - kPrefixSlots, m_vtable + slotCount, m_shadow.get());
+
+        Attach(object);
+    }
+}
+
+VTableHook::~VTableHook()
+{
+    UnhookAll();
+
+    while (!m_objects.empty())
+    {
+        Detach(m_objects.back());
+    }
+}
+
+bool VTableHook::Attach(void* object)
+{
+    if (m_mode != kPerInstance || !IsValid() || !object || *static_cast<void***>(object) != m_vtable)
+    {
+        return false;
+    }
+
+    m_objects.push_back(object);
+    *static_cast<void***>(object) = m_shadow.get() + kPrefixSlots;
+    return true;
+}
+
+bool VTableHook::Detach(void* object)
+{
+    auto it = std::find(m_objects.begin(), m_objects.end(), object);
+
+    if (it == m_objects.end())
+    {
+        return false;
+    }
+
+    m_objects.erase(it);
+
+    // Leave objects alone that got another vptr in the meantime (another hook, or a destructor running)
+    void*** vptr = static_cast<void***>(object);
+
+    if (*vptr == m_shadow.get() + kPrefixSlots)
+    {
+        *vptr = m_vtable;
+    }
+
+    return true;
+}
+
+bool VTableHook::Hook(size_t index, MemoryPointer replacement)
+{
+    return index < m_slotCount && WriteSlot(index, replacement.Get());
+}
+
+bool VTableHook::Unhook(size_t index)
+{
+    return index < m_slotCount && WriteSlot(index, m_originals[index]);
+}
+
+void VTableHook::UnhookAll()
+{
+    for (size_t i = 0; i < m_slotCount; i++)
+    {
+        Unhook(i);
+    }
+}
+
+bool VTableHook::WriteSlot(size_t index, void* function)
+{
+    if (m_mode == kPerInstance)
+    {
+        m_shadow[kPrefixSlots + index] = function;
+        return true;
+    }
+
+    if (m_vtable[index] == function)
+    {
+        return true;
+    }
+
+    PatchTransaction transaction;
+    return transaction.Write<void*>(&m_vtable[index], function).Commit();
+}
+
+}  // namespace hook
@@ -0,0 +1,110 @@
+// Virtual method table hooks
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "build/BuildConfig.hpp"
+#include "client/hook/MemoryPointer.hpp"
+
+namespace hook
+{
+
+// Hooks virtual functions of a class, either for chosen objects or for the class as a whole:
+//   - kPerInstance copies the vtable into a shadow on the heap and points the vptr of every attached object at it.
+//     Hooking a slot is a plain pointer store into the shadow, with no protection changes, and objects that aren't
+//     attached keep calling the original functions.
+//   - kPerClass patches the slots of the class's own vtable, which hooks every object of that exact class.
+// Replacements are called directly by the virtual call, there's no trampoline in between.
+//
+// Usage:
+//   VTableHook hook(entity);
+//   s_originalProcess = hook.Hook(5, &ProcessHooked);
+//
+// Attached objects have to be detached (or the hook destroyed) before they are destroyed.
+class VTableHook
+{
+public:
+    enum Mode
+    {
+        kPerInstance,
+        kPerClass
+    };
+
+    // Slots before the first function pointer that are copied into the shadow as well: the RTTI complete object
+    // locator on MSVC, offset-to-top and type_info on the Itanium ABI
+#if defined(OS_WIN)
+    static const size_t kPrefixSlots = 1;
+#else
+    static const size_t kPrefixSlots = 2;
+#endif
+
+    // |object| is attached right away in kPerInstance mode. A |slotCount| of 0 counts the slots up to the first one
+    // that doesn't point to code.
+    explicit VTableHook(void* object, Mode mode = kPerInstance, size_t slotCount = 0);
+
+    // Unhooks every slot and detaches every object that still points at the shadow
+    ~VTableHook();
+
+    VTableHook(const VTableHook&) = delete;
+    VTableHook& operator=(const VTableHook&) = delete;
+
+    // Points |object|, which has to be of the same class, at the shadow. kPerInstance only.
+    bool Attach(void* object);
+    bool Detach(void* object);
+
+    // Returns false if |index| is out of range
+    bool Hook(size_t index, MemoryPointer replacement);
+
+    // Typed variant, returns the original function or nullptr
+    template <typename T>
+    T Hook(size_t index, T replacement)
+    {
+        if (!Hook(index, MemoryPointer(reinterpret_cast<void*>(replacement))))
+        {
+            return nullptr;
+        }
+
+        return GetOriginal<T>(index);
+    }
+
+    bool Unhook(size_t index);
+    void UnhookAll();
+
+    template <typename T>
+    T GetOriginal(size_t index) const
+    {
+        return index < m_slotCount ? reinterpret_cast<T>(m_originals[index]) : nullptr;
+    }
+
+    bool IsValid() const { return m_slotCount != 0; }
+    size_t GetSlotCount() const { return m_slotCount; }
+    Mode GetMode() const { return m_mode; }
+
+private:
+    bool WriteSlot(size_t index, void* function);
+
+    Mode m_mode;
+
+    // Table the objects' vptr pointed at, past the prefix
+    void** m_vtable;
+    size_t m_slotCount;
+
+    std::vector<void*> m_originals;
+
+    // Prefix followed by the slots, kPerInstance only
+    std::unique_ptr<void*[]> m_shadow;
+    std::vector<void*> m_objects;
+};
+
+}  // namespace hook
@@ -0,0 +1,125 @@
+// Worker thread pool
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#include "client/hook/WorkerPool.hpp"
+
+#include <algorithm>
+
+namespace hook
+{
+
+static thread_local bool isWorkerThread = false;
+
+WorkerPool::WorkerPool(size_t threadCount) :
+    m_task(nullptr),
+    m_count(0),
+    m_next(0),
+    m_active(0),
+    m_generation(0),
+    m_stop(false)
+{
+    for (size_t i = 0; i < threadCount; i++)
+    {
+        m_threads.emplace_back(&WorkerPool::WorkerMain, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+
+    m_wake.notify_all();
+
+    for (auto& thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+WorkerPool& WorkerPool::Get()
+{
+    static WorkerPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+void WorkerPool::ParallelFor(size_t count, const std::function<void(size_t)>& task)
+{
+    std::unique_lock<std::mutex> job(m_jobMutex, std::try_to_lock);
+
+    if (isWorkerThread || !job.owns_lock() || m_threads.empty() || count < 2)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            task(i);
+        }
+
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task = &task;
+        m_count = count;
+        m_next = 0;
+        m_active = m_threads.size();
+        m_generation++;
+    }
+
+    m_wake.notify_all();
+
+    // Take part in the work, then wait for the stragglers
+    isWorkerThread = true;
+    RunTasks();
+    isWorkerThread = false;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return m_active == 0; });
+    m_task = nullptr;
+}
+
+void WorkerPool::WorkerMain()
+{
+    isWorkerThread = true;
+
+    uint64_t generation = 0;
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    for (;;)
+    {
+        m_wake.wait(lock, [&] { return m_stop || m_generation != generation; });
+
+        if (m_stop)
+        {
+            return;
+        }
+
+        generation = m_generation;
+
+        lock.unlock();
+        RunTasks();
+        lock.lock();
+
+        if (--m_active == 0)
+        {
+            m_done.notify_all();
+        }
+    }
+}
+
+void WorkerPool::RunTasks()
+{
+    for (size_t i; (i = m_next.fetch_add(1)) < m_count;)
+    {
+        (*m_task)(i);
+    }
+}
+
+}  // namespace hook
@@ -0,0 +1,63 @@
+// Worker thread pool
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hook
+{
+
+// Fixed set of threads that run one ParallelFor at a time. The calling thread takes part in the work too.
+class WorkerPool
+{
+public:
+    explicit WorkerPool(size_t threadCount);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Shared pool, sized to the hardware concurrency
+    static WorkerPool& Get();
+
+    // Calls |task| for every index in [0, count) and returns once all of them finished. Nested calls (or calls
+    // while another thread owns the pool) run serially on the calling thread instead of deadlocking.
+    void ParallelFor(size_t count, const std::function<void(size_t)>& task);
+
+    // Number of threads that work on a ParallelFor, including the caller
+    size_t Concurrency() const { return m_threads.size() + 1; }
+
+private:
+    void WorkerMain();
+    void RunTasks();
+
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_jobMutex;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+
+    const std::function<void(size_t)>* m_task;
+    size_t m_count;
+    std::atomic<size_t> m_next;
+    size_t m_active;
+    uint64_t m_generation;
+    bool m_stop;
+};
+
+}  // namespace hook
@@ -0,0 +1,288 @@
+// Cross-reference index
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#include "client/hook/XrefIndex.hpp"
+#include "client/hook/WorkerPool.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace hook
+{
+
+// Work is split in chunks of this size
+static const uintptr_t kChunkSize = 0x40000;
+
+// A chunk starts decoding this far before its first byte, by then the decoder is back in step with the instruction
+// stream in all but pathological cases
+static const uintptr_t kResyncDistance = 64;
+
+static const size_t kMaxInstructionLength = 15;
+
+// Kind of branch at |code|, as it was indexed
+static bool GetKind(const Instruction& instruction, XrefIndex::Kind& kind)
+{
+    const uint8_t opcode = instruction.opcode;
+
+    if (instruction.opcodeMap == Instruction::kMapOneByte && instruction.relativeBranch && instruction.immSize >= 2)
+    {
+        if (opcode == 0xE8)
+        {
+            kind = XrefIndex::kCall;
+            return true;
+        }
+
+        if (opcode == 0xE9)
+        {
+            kind = XrefIndex::kJump;
+            return true;
+        }
+    }
+    else if (instruction.opcodeMap == Instruction::kMap0F && instruction.relativeBranch && (opcode & 0xF0) == 0x80)
+    {
+        kind = XrefIndex::kConditionalJump;
+        return true;
+    }
+    else if (instruction.opcodeMap == Instruction::kMapOneByte && opcode == 0xFF && instruction.hasModRM &&
+        (instruction.reg() == 2 || instruction.reg() == 4))
+    {
+#if defined(ARCH_CPU_X86_64)
+        const bool fixedAddress = instruction.ripRelative;
+#else
+        const bool fixedAddress = instruction.mod() == 0 && instruction.rm() == 5 && !instruction.hasAddressSizePrefix;
+#endif
+
+        if (fixedAddress)
+        {
+            kind = instruction.reg() == 2 ? XrefIndex::kIndirectCall : XrefIndex::kIndirectJump;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Address the branch at |code| (located at |address|) refers to
+static uintptr_t GetTarget(const uint8_t* code, uintptr_t address, const Instruction& instruction,
+    XrefIndex::Kind kind)
+{
+    if (kind == XrefIndex::kIndirectCall || kind == XrefIndex::kIndirectJump)
+    {
+#if defined(ARCH_CPU_X86_64)
+        return instruction.RipTarget(code, address);
+#else
+        return static_cast<uintptr_t>(instruction.Displacement(code));
+#endif
+    }
+
+    return instruction.BranchTarget(code, address);
+}
+
+// Instructions of |range| that start in [begin, end)
+static void CollectRange(const ExecutableMeta& executable, const ExecutableMeta::Range& range, uintptr_t begin,
+    uintptr_t end, const ReferenceVisitor& visit, std::vector<CodeReference>& references)
+{
+    const uintptr_t base = executable.base();
+
+    uintptr_t address = begin - std::min(begin - range.begin, kResyncDistance);
+
+    // The last few bytes of the range are decoded from a padded copy, the decoder may read up to 15 bytes ahead
+    uint8_t tail[kMaxInstructionLength * 2];
+
+    while (address < end)
+    {
+        const uint8_t* code = reinterpret_cast<const uint8_t*>(address);
+
+        if (range.end - address < kMaxInstructionLength)
+        {
+            memset(tail, 0xCC, sizeof(tail));
+            memcpy(tail, code, range.end - address);
+            code = tail;
+        }
+
+        Instruction instruction;
+
+        if (!DecodeInstruction(code, instruction))
+        {
+            address++;
+            continue;
+        }
+
+        uintptr_t targets[2];
+        const size_t count = address >= begin ? visit(code, address, instruction, targets) : 0;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (targets[i] >= base && targets[i] - base <= UINT32_MAX)
+            {
+                references.push_back({static_cast<uint32_t>(targets[i] - base), static_cast<uint32_t>(address - base)});
+            }
+        }
+
+        address += instruction.length;
+    }
+}
+
+std::vector<CodeReference> CollectReferences(const ExecutableMeta& executable, bool parallel,
+    const ReferenceVisitor& visit)
+{
+    struct Chunk
+    {
+        const ExecutableMeta::Range* range;
+        uintptr_t begin;
+        uintptr_t end;
+        std::vector<CodeReference> references;
+    };
+
+    std::vector<Chunk> chunks;
+
+    for (size_t i = 0; i < executable.rangeCount(); i++)
+    {
+        const ExecutableMeta::Range& range = executable.ranges()[i];
+
+        for (uintptr_t begin = range.begin; begin < range.end; begin += kChunkSize)
+        {
+            chunks.push_back({&range, begin, std::min(begin + kChunkSize, range.end), {}});
+        }
+    }
+
+    auto collect = [&executable, &visit, &chunks](size_t index)
+    {
+        Chunk& chunk = chunks[index];
+        CollectRange(executable, *chunk.range, chunk.begin, chunk.end, visit, chunk.references);
+    };
+
+    if (parallel)
+    {
+        WorkerPool::Get().ParallelFor(chunks.size(), collect);
+    }
+    else
+    {
+        for (size_t i = 0; i < chunks.size(); i++)
+        {
+            collect(i);
+        }
+    }
+
+    size_t count = 0;
+
+    for (const Chunk& chunk : chunks)
+    {
+        count += chunk.references.size();
+    }
+
+    std::vector<CodeReference> references;
+    references.reserve(count);
+
+    for (const Chunk& chunk : chunks)
+    {
+        references.insert(references.end(), chunk.references.begin(), chunk.references.end());
+    }
+
+    std::sort(references.begin(), references.end(), [](const CodeReference& a, const CodeReference& b)
+    {
+        return a.target != b.target ? a.target < b.target : a.source < b.source;
+    });
+
+    return references;
+}
+
+XrefIndex::XrefIndex() :
+    m_executable(reinterpret_cast<void*>(ExecutableMeta::GetMainModule()))
+{
+}
+
+XrefIndex::XrefIndex(void* module) :
+    m_executable(module)
+{
+}
+
+XrefIndex::XrefIndex(uintptr_t begin, uintptr_t end) :
+    m_executable(begin, end)
+{
+}
+
+void XrefIndex::Build(bool parallel)
+{
+    std::call_once(m_built, [this, parallel]()
+    {
+        m_entries = CollectReferences(m_executable, parallel,
+            [](const uint8_t* code, uintptr_t address, const Instruction& instruction, uintptr_t targets[2]) -> size_t
+        {
+            Kind kind;
+
+            if (!GetKind(instruction, kind))
+            {
+                return 0;
+            }
+
+            targets[0] = GetTarget(code, address, instruction, kind);
+            return 1;
+        });
+    });
+}
+
+std::pair<const CodeReference*, const CodeReference*> XrefIndex::EqualRange(MemoryPointer target)
+{
+    Build();
+
+    const uintptr_t base = m_executable.base();
+    const uintptr_t address = target.AsInt();
+
+    if (address < base || address - base > UINT32_MAX || m_entries.empty())
+    {
+        return {nullptr, nullptr};
+    }
+
+    const uint32_t rva = static_cast<uint32_t>(address - base);
+    const CodeReference* first = m_entries.data();
+    const CodeReference* last = first + m_entries.size();
+
+    return std::equal_range(first, last, CodeReference{rva, 0}, [](const CodeReference& a, const CodeReference& b)
+    {
+        return a.target < b.target;
+    });
+}
+
+std::vector<XrefIndex::Xref> XrefIndex::Find(MemoryPointer target)
+{
+    std::vector<Xref> xrefs;
+    auto range = EqualRange(target);
+
+    for (const CodeReference* entry = range.first; entry != range.second; entry++)
+    {
+        const uintptr_t source = m_executable.base() + entry->source;
+        const uint8_t* code = reinterpret_cast<const uint8_t*>(source);
+
+        Instruction instruction;
+        Kind kind;
+
+        // Read back from the code, it's cheaper than keeping it in every entry. Skip anything patched since.
+        if (DecodeInstruction(code, instruction) && GetKind(instruction, kind) &&
+            GetTarget(code, source, instruction, kind) == target.AsInt())
+        {
+            xrefs.push_back({source, kind});
+        }
+    }
+
+    return xrefs;
+}
+
+size_t XrefIndex::Count(MemoryPointer target)
+{
+    auto range = EqualRange(target);
+    return static_cast<size_t>(range.second - range.first);
+}
+
+size_t XrefIndex::Size()
+{
+    Build();
+    return m_entries.size();
+}
+
+}  // namespace hook
@@ -0,0 +1,101 @@
+// Cross-reference index
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "client/hook/ExecutableMeta.hpp"
+#include "client/hook/InstructionDecoder.hpp"
+#include "client/hook/MemoryPointer.hpp"
+
+namespace hook
+{
+
+// Address referred to by an instruction, both relative to the module base to keep it at 8 bytes
+struct CodeReference
+{
+    uint32_t target;
+    uint32_t source;
+};
+
+// Stores up to two addresses the instruction at |code| (located at |address|) refers to in |targets|, returns how many
+using ReferenceVisitor = std::function<size_t(const uint8_t* code, uintptr_t address, const Instruction& instruction,
+    uintptr_t targets[2])>;
+
+// Decodes the code ranges of |executable| linearly, in chunks on the shared worker pool if |parallel| is set, and
+// collects what |visit| finds. The result is sorted by target, then source. Targets outside of 4 GB from the base
+// don't belong to the module and are dropped.
+std::vector<CodeReference> CollectReferences(const ExecutableMeta& executable, bool parallel,
+    const ReferenceVisitor& visit);
+
+// Decodes the code of a module once and keeps every branch to a known address, sorted by target:
+//   - call/jmp/jcc rel32 (rel8 branches stay within a function and aren't kept)
+//   - call/jmp through memory at a fixed address ([disp32] on x86, [rip + disp32] on x64), keyed by the memory slot
+// Looking up every caller of a function is then a binary search.
+//
+// Usage:
+//   XrefIndex index;
+//   for (const XrefIndex::Xref& xref : index.Find(0x53E980))
+//       if (xref.kind == XrefIndex::kCall) MakeCall(xref.source, ProcessHooked);
+class XrefIndex
+{
+public:
+    enum Kind
+    {
+        kCall,
+        kJump,
+        kConditionalJump,
+        kIndirectCall,
+        kIndirectJump
+    };
+
+    struct Xref
+    {
+        uintptr_t source;  // First byte of the instruction
+        Kind kind;
+    };
+
+    // Indexes the process main module
+    XrefIndex();
+
+    explicit XrefIndex(void* module);
+
+    XrefIndex(uintptr_t begin, uintptr_t end);
+
+    XrefIndex(const XrefIndex&) = delete;
+    XrefIndex& operator=(const XrefIndex&) = delete;
+
+    // Decodes the code range, in chunks on the shared worker pool if |parallel| is set. The first lookup builds the
+    // index if this wasn't called before. Only the first call does anything.
+    void Build(bool parallel = true);
+
+    // Every reference to |target|, in address order
+    std::vector<Xref> Find(MemoryPointer target);
+
+    size_t Count(MemoryPointer target);
+
+    // Number of references in the index
+    size_t Size();
+
+private:
+    // Range of entries for |target|
+    std::pair<const CodeReference*, const CodeReference*> EqualRange(MemoryPointer target);
+
+    ExecutableMeta m_executable;
+
+    std::vector<CodeReference> m_entries;
+    std::once_flag m_built;
+};
+
+}  // namespace hook
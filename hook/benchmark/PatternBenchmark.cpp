@@ -0,0 +1,513 @@
+// Pattern scanner benchmark
+// Author(s):       iFarbod <ifarbod@outlook.com>
+//
+// Copyright (c) 2013-2017 CTNorth Team
+//
+// Distributed under the MIT license (See accompanying file LICENSE or copy at
+// https://opensource.org/licenses/MIT)
+//
+// Measures scan throughput over large x86/x64 code buffers, either synthetic (built from common instruction
+// encodings with random operands) or recorded (a raw code section dumped to disk). Every pattern is resolved by a
+// naive reference matcher, the scalar kernel, the dispatched SIMD kernel, the parallel mode and a batch, and the
+// results have to agree. Exits with a non-zero code on any mismatch.
+//
+// Usage: HookBenchmark [--size <MiB>] [--iterations <n>] [--file <code dump>] [--seed <n>]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "client/hook/Pattern.hpp"
+#include "client/hook/PatternBatch.hpp"
+#include "client/hook/PatternScanner.hpp"
+
+namespace
+{
+
+using hook::Pattern;
+using hook::PatternBatch;
+using hook::PatternScanner;
+
+// RangePattern only takes literals, the benchmark builds its patterns at runtime
+class RuntimePattern : public Pattern
+{
+public:
+    RuntimePattern(uintptr_t begin, uintptr_t end, const std::string& pattern) :
+        Pattern(begin, end)
+    {
+        Initialize(pattern.c_str(), pattern.size());
+    }
+};
+
+struct Corpus
+{
+    std::string name;
+    std::vector<uint8_t> code;
+};
+
+// Canonical form of a benchmark pattern, plus its IDA string
+struct Signature
+{
+    std::string name;
+    std::string ida;
+    std::string bytes;
+    std::string mask;
+};
+
+struct Options
+{
+    size_t size = 64;
+    int iterations = 3;
+    uint32_t seed = 1;
+    const char* file = nullptr;
+};
+
+// Instruction encodings with the operand bytes marked: 'b' is a small displacement/immediate, 'r' a rel32, 'i' an
+// imm32/abs32
+struct Encoding
+{
+    const char* bytes;
+    const char* operands;
+};
+
+const Encoding kX86Body[] =
+{
+    {"\x8B\x45", "b"}, {"\x89\x45", "b"}, {"\x8B\x4D", "b"}, {"\x8B\x55", "b"}, {"\xE8", "r"}, {"\x85\xC0", ""},
+    {"\x74", "b"}, {"\x75", "b"}, {"\x6A", "b"}, {"\x68", "i"}, {"\x8B\x0D", "i"}, {"\xA1", "i"},
+    {"\xC7\x45", "bi"}, {"\x33\xC0", ""}, {"\x0F\x84", "r"}, {"\x83\xC4", "b"}, {"\x8D\x4D", "b"}, {"\x50", ""},
+    {"\x51", ""}, {"\x8B\xCE", ""}, {"\x8B\xF1", ""}, {"\xFF\x15", "i"}, {"\x3B\xC3", ""}, {"\x0F\xB6\x45", "b"},
+};
+
+const Encoding kX64Body[] =
+{
+    {"\x48\x89\x5C\x24", "b"}, {"\x48\x8B\x05", "r"}, {"\x48\x8D\x0D", "r"}, {"\xE8", "r"}, {"\x85\xC0", ""},
+    {"\x74", "b"}, {"\x75", "b"}, {"\x48\x8B\xC8", ""}, {"\x4C\x8B\xC0", ""}, {"\x41\xB8", "i"},
+    {"\x48\x8B\x4C\x24", "b"}, {"\x48\x8B\xD9", ""}, {"\x0F\x84", "r"}, {"\xFF\x15", "r"}, {"\x48\x85\xC9", ""},
+    {"\x33\xD2", ""}, {"\x48\x8B\x01", ""}, {"\xFF\x50", "b"}, {"\x0F\x1F\x44\x00\x00", ""}, {"\xC7\x44\x24", "bi"},
+};
+
+void Emit(std::vector<uint8_t>& out, const Encoding& encoding, std::mt19937& rng)
+{
+    // The encodings above never contain a zero byte, except for the trailing nop operands
+    const size_t length = encoding.bytes[0] == '\x0F' && encoding.bytes[1] == '\x1F' ? 5 : strlen(encoding.bytes);
+    out.insert(out.end(), encoding.bytes, encoding.bytes + length);
+
+    for (const char* operand = encoding.operands; *operand; operand++)
+    {
+        uint32_t value = 0;
+        size_t size = 4;
+
+        switch (*operand)
+        {
+            case 'b':
+                value = (rng() % 32) * 4;
+                size = 1;
+                break;
+            case 'r':
+                value = static_cast<uint32_t>(static_cast<int32_t>(rng() % 0x200000) - 0x100000);
+                break;
+            case 'i':
+                value = 0x00400000 + (rng() % 0x800000);
+                break;
+        }
+
+        for (size_t i = 0; i < size; i++)
+        {
+            out.push_back(static_cast<uint8_t>(value >> (i * 8)));
+        }
+    }
+}
+
+Corpus MakeSyntheticCorpus(bool x64, size_t size, std::mt19937& rng)
+{
+    Corpus corpus;
+    corpus.name = x64 ? "synthetic x64" : "synthetic x86";
+    corpus.code.reserve(size + 1024);
+
+    static const uint8_t kX86Prologue[] = {0x55, 0x8B, 0xEC, 0x83, 0xEC};
+    static const uint8_t kX86Epilogue[] = {0x8B, 0xE5, 0x5D, 0xC3};
+    static const uint8_t kX64Prologue[] = {0x48, 0x83, 0xEC};
+    static const uint8_t kX64Epilogue[] = {0x48, 0x83, 0xC4, 0x28, 0xC3};
+
+    while (corpus.code.size() < size)
+    {
+        if (x64)
+        {
+            corpus.code.insert(corpus.code.end(), std::begin(kX64Prologue), std::end(kX64Prologue));
+        }
+        else
+        {
+            corpus.code.insert(corpus.code.end(), std::begin(kX86Prologue), std::end(kX86Prologue));
+        }
+
+        corpus.code.push_back(static_cast<uint8_t>((rng() % 16) * 8));
+
+        for (size_t i = 0, count = 10 + rng() % 50; i < count; i++)
+        {
+            if (x64)
+            {
+                Emit(corpus.code, kX64Body[rng() % (sizeof(kX64Body) / sizeof(kX64Body[0]))], rng);
+            }
+            else
+            {
+                Emit(corpus.code, kX86Body[rng() % (sizeof(kX86Body) / sizeof(kX86Body[0]))], rng);
+            }
+        }
+
+        if (x64)
+        {
+            corpus.code.insert(corpus.code.end(), std::begin(kX64Epilogue), std::end(kX64Epilogue));
+        }
+        else
+        {
+            corpus.code.insert(corpus.code.end(), std::begin(kX86Epilogue), std::end(kX86Epilogue));
+        }
+
+        // int3 padding up to the next 16 byte boundary
+        while (corpus.code.size() % 16 != 0)
+        {
+            corpus.code.push_back(0xCC);
+        }
+    }
+
+    corpus.code.resize(size);
+    return corpus;
+}
+
+bool LoadRecordedCorpus(const char* path, Corpus& corpus)
+{
+    std::ifstream file(path, std::ios::binary);
+
+    if (!file)
+    {
+        return false;
+    }
+
+    corpus.name = std::string("recorded ") + path;
+    corpus.code.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !corpus.code.empty();
+}
+
+// Byte-by-byte reference, deliberately without any skipping
+size_t NaiveCount(const Corpus& corpus, const Signature& signature, std::vector<const uint8_t*>* matches = nullptr)
+{
+    const uint8_t* begin = corpus.code.data();
+    const size_t size = signature.mask.size();
+    size_t count = 0;
+
+    for (size_t i = 0; i + size <= corpus.code.size(); i++)
+    {
+        size_t j = 0;
+
+        while (j < size && (begin[i + j] & static_cast<uint8_t>(signature.mask[j])) ==
+                static_cast<uint8_t>(signature.bytes[j]))
+        {
+            j++;
+        }
+
+        if (j == size)
+        {
+            count++;
+
+            if (matches)
+            {
+                matches->push_back(begin + i);
+            }
+        }
+    }
+
+    return count;
+}
+
+const char kHex[] = "0123456789ABCDEF";
+
+Signature MakeSignature(const Corpus& corpus, size_t offset, size_t length, double wildcardDensity,
+    std::mt19937& rng)
+{
+    Signature signature;
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+    for (size_t i = 0; i < length; i++)
+    {
+        // Keep both ends fixed, like a real signature
+        const bool wildcard = i != 0 && i + 1 != length && chance(rng) < wildcardDensity;
+        const uint8_t value = corpus.code[offset + i];
+
+        if (!signature.ida.empty())
+        {
+            signature.ida.push_back(' ');
+        }
+
+        if (wildcard)
+        {
+            signature.ida.push_back('?');
+            signature.bytes.push_back(0);
+            signature.mask.push_back(0);
+        }
+        else
+        {
+            signature.ida.push_back(kHex[value >> 4]);
+            signature.ida.push_back(kHex[value & 15]);
+            signature.bytes.push_back(static_cast<char>(value));
+            signature.mask.push_back(static_cast<char>(0xFF));
+        }
+    }
+
+    return signature;
+}
+
+// Picks a signature of the wanted kind: "single" (exactly one hit), "many" (a common sequence) or "none"
+bool PickSignature(const Corpus& corpus, const char* kind, size_t length, double wildcardDensity, std::mt19937& rng,
+    Signature& out)
+{
+    for (int attempt = 0; attempt < 64; attempt++)
+    {
+        const size_t offset = rng() % (corpus.code.size() - length);
+        Signature signature = MakeSignature(corpus, offset, length, wildcardDensity, rng);
+
+        if (!strcmp(kind, "none"))
+        {
+            // Break the last fixed byte
+            const uint8_t value = static_cast<uint8_t>(signature.bytes.back() ^ 0x5A);
+
+            signature.bytes.back() = static_cast<char>(value);
+            signature.ida.replace(signature.ida.size() - 2, 2, {kHex[value >> 4], kHex[value & 15]});
+        }
+
+        const size_t count = NaiveCount(corpus, signature);
+
+        if ((!strcmp(kind, "single") && count == 1) || (!strcmp(kind, "none") && count == 0) ||
+            (!strcmp(kind, "many") && count >= 64))
+        {
+            signature.name = std::string(kind) + " len=" + std::to_string(length) +
+                " wild=" + std::to_string(static_cast<int>(wildcardDensity * 100)) + "%";
+            out = signature;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Best of |iterations| runs, in seconds
+double Measure(int iterations, const std::function<void()>& function)
+{
+    double best = 1e30;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        function();
+        const auto end = std::chrono::steady_clock::now();
+
+        best = std::min(best, std::chrono::duration<double>(end - start).count());
+    }
+
+    return best;
+}
+
+void Report(const char* method, size_t bytes, double seconds)
+{
+    printf("    %-10s %9.3f ms  %7.2f GB/s\n", method, seconds * 1e3, bytes / seconds / 1e9);
+}
+
+bool RunCorpus(const Corpus& corpus, const Options& options, std::mt19937& rng)
+{
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(corpus.code.data());
+    const uintptr_t end = begin + corpus.code.size();
+    const size_t bytes = corpus.code.size();
+
+    bool ok = true;
+    std::vector<Signature> signatures;
+    std::vector<size_t> expectedCounts;
+
+    printf("%s, %.1f MiB\n", corpus.name.c_str(), bytes / 1048576.0);
+
+    for (const char* kind : {"single", "many", "none"})
+    {
+        for (size_t length : {8, 16, 32})
+        {
+            for (double density : {0.0, 0.25, 0.5})
+            {
+                Signature signature;
+
+                if (!PickSignature(corpus, kind, length, density, rng, signature))
+                {
+                    continue;
+                }
+
+                std::vector<const uint8_t*> expected;
+                NaiveCount(corpus, signature, &expected);
+
+                printf("  %-28s %zu match(es)\n", signature.name.c_str(), expected.size());
+
+                Report("naive", bytes, Measure(options.iterations, [&] { NaiveCount(corpus, signature); }));
+
+                PatternScanner scanner(reinterpret_cast<const uint8_t*>(signature.bytes.data()),
+                    reinterpret_cast<const uint8_t*>(signature.mask.data()), signature.mask.size());
+
+                std::vector<const uint8_t*> scalar;
+                Report("scalar", bytes, Measure(options.iterations, [&]
+                {
+                    scalar.clear();
+
+                    for (const uint8_t* ptr = corpus.code.data();
+                         (ptr = scanner.FindNextScalar(ptr, corpus.code.data() + bytes)) != nullptr; ptr++)
+                    {
+                        scalar.push_back(ptr);
+                    }
+                }));
+
+                size_t kernelCount = 0;
+                Report("kernel", bytes, Measure(options.iterations, [&]
+                {
+                    kernelCount = RuntimePattern(begin, end, signature.ida).Size();
+                }));
+
+                size_t parallelCount = 0;
+                Report("parallel", bytes, Measure(options.iterations, [&]
+                {
+                    parallelCount = RuntimePattern(begin, end, signature.ida).Parallel().Size();
+                }));
+
+                if (scalar != expected || kernelCount != expected.size() || parallelCount != expected.size())
+                {
+                    printf("    MISMATCH: scalar %zu, kernel %zu, parallel %zu\n", scalar.size(), kernelCount,
+                        parallelCount);
+                    ok = false;
+                }
+
+                signatures.push_back(signature);
+                expectedCounts.push_back(expected.size());
+            }
+        }
+    }
+
+    // All of the above resolved one after another, then in a single batch
+    const double separate = Measure(options.iterations, [&]
+    {
+        for (const Signature& signature : signatures)
+        {
+            RuntimePattern(begin, end, signature.ida).Size();
+        }
+    });
+
+    std::vector<size_t> batchCounts;
+    const double batched = Measure(options.iterations, [&]
+    {
+        PatternBatch batch(begin, end);
+        std::vector<Pattern*> patterns;
+
+        for (const Signature& signature : signatures)
+        {
+            patterns.push_back(&batch.Add(signature.ida));
+        }
+
+        batch.Scan();
+        batchCounts.clear();
+
+        for (Pattern* pattern : patterns)
+        {
+            batchCounts.push_back(pattern->Size());
+        }
+    });
+
+    for (size_t i = 0; i < signatures.size(); i++)
+    {
+        if (batchCounts[i] != expectedCounts[i])
+        {
+            printf("  MISMATCH: %s, batch %zu, expected %zu\n", signatures[i].name.c_str(), batchCounts[i],
+                expectedCounts[i]);
+            ok = false;
+        }
+    }
+
+    printf("  %zu patterns: separate %.3f ms (%.3f ms/pattern), batch %.3f ms (%.3f ms/pattern)\n\n",
+        signatures.size(), separate * 1e3, separate * 1e3 / signatures.size(), batched * 1e3,
+        batched * 1e3 / signatures.size());
+
+    return ok;
+}
+
+bool ParseOptions(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const bool hasValue = i + 1 < argc;
+
+        if (!strcmp(argv[i], "--size") && hasValue)
+        {
+            options.size = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "--iterations") && hasValue)
+        {
+            options.iterations = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--seed") && hasValue)
+        {
+            options.seed = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (!strcmp(argv[i], "--file") && hasValue)
+        {
+            options.file = argv[++i];
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return options.size != 0 && options.iterations > 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+
+    if (!ParseOptions(argc, argv, options))
+    {
+        printf("Usage: %s [--size <MiB>] [--iterations <n>] [--file <code dump>] [--seed <n>]\n", argv[0]);
+        return 2;
+    }
+
+    std::mt19937 rng(options.seed);
+    std::vector<Corpus> corpora;
+
+    if (options.file)
+    {
+        Corpus corpus;
+
+        if (!LoadRecordedCorpus(options.file, corpus))
+        {
+            printf("Can't read %s\n", options.file);
+            return 2;
+        }
+
+        corpora.push_back(std::move(corpus));
+    }
+    else
+    {
+        corpora.push_back(MakeSyntheticCorpus(false, options.size << 20, rng));
+        corpora.push_back(MakeSyntheticCorpus(true, options.size << 20, rng));
+    }
+
+    bool ok = true;
+
+    for (const Corpus& corpus : corpora)
+    {
+        ok &= RunCorpus(corpus, options, rng);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,25 @@
+project "HookBenchmark"
+    language "C++"
+    kind "ConsoleApp"
+
+    vpaths
+    {
+        ["Headers/*"] = "**.hpp",
+        ["Sources/*"] = "**.cpp",
+        ["*"] = "premake5.lua"
+    }
+
+    files
+    {
+        "premake5.lua",
+        "*.cpp",
+        "*.hpp"
+    }
+
+    links
+    {
+        "Hook"
+    }
+
+    filter "system:linux"
+        links { "dl", "pthread" }
@@ -15,3 +15,5 @@ project "Hook"
         "*.cpp",
         "*.hpp"
     }
+
+include "benchmark"